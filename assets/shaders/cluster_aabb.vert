@@ -0,0 +1,41 @@
+#version 430 core
+// one instance per cluster from firstCluster on, 24 vertices each: the 12
+// edges of its view space aabb as a line list. No vertex attributes, the
+// corners and light count come straight from clusterSSBO
+
+flat out vec4 DebugColor;
+
+#include "include/frame.glsl"
+#include "include/clusters.glsl"
+#include "include/debug_colors.glsl"
+
+uniform uint firstCluster;
+uniform bool nonEmptyOnly;
+
+const vec4 EMPTY_COLOR = vec4(0.25, 0.25, 0.25, 1.0);
+
+// corner bits are x, y, z: 0 takes minPoint, 1 maxPoint
+const uint EDGE_CORNERS[24] =
+    uint[](0u, 1u, 2u, 3u, 4u, 5u, 6u, 7u,  // along x
+           0u, 2u, 1u, 3u, 4u, 6u, 5u, 7u,  // along y
+           0u, 4u, 1u, 5u, 2u, 6u, 3u, 7u); // along z
+
+void main()
+{
+    Cluster cluster = clusters[firstCluster + gl_InstanceID];
+    if (nonEmptyOnly && cluster.count == 0u)
+    {
+        // behind the far plane, clipped
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        DebugColor = EMPTY_COLOR;
+        return;
+    }
+
+    uint corner = EDGE_CORNERS[gl_VertexID];
+    vec3 select = vec3(corner & 1u, (corner >> 1) & 1u, (corner >> 2) & 1u);
+    vec3 viewPos = mix(cluster.minPoint.xyz, cluster.maxPoint.xyz, select);
+    gl_Position = projection * vec4(viewPos, 1.0);
+
+    float load = float(cluster.count) / float(MAX_LIGHTS_PER_CLUSTER);
+    DebugColor = cluster.count == 0u ? EMPTY_COLOR : vec4(heat_color(load), 1.0);
+}
@@ -1,8 +0,0 @@
-#version 430 core
-layout(location = 0) in vec3 aPos;
-layout(location = 3) in mat4 model;
-
-uniform mat4 view;
-uniform mat4 projection;
-
-void main() { gl_Position = projection * view * model * vec4(aPos, 1.0); }
@@ -0,0 +1,6 @@
+#version 430 core
+out vec4 FragColor;
+
+flat in vec4 DebugColor;
+
+void main() { FragColor = DebugColor; }
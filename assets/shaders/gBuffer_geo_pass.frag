@@ -1,4 +1,5 @@
 #version 430 core
+
 layout(location = 0) out vec3 gPosition;
 layout(location = 1) out vec3 gNormal;
 layout(location = 2) out vec4 gAlbedoSpec;
@@ -6,8 +7,42 @@ layout(location = 2) out vec4 gAlbedoSpec;
 in vec2 TexCoords;
 in vec3 FragPos;
 in vec3 Normal;
+flat in uint MaterialIndex;
+
+#include "include/materials.glsl"
 
-uniform sampler2D texture_diffuse1;
+// one texture array per format and size, see MaterialLibrary::bind
+layout(binding = 0) uniform sampler2DArray materialArrays[16];
+
+// sampler arrays may only be indexed with constants here, the array differs
+// between draws of one multi draw
+#define SAMPLE_CASE(i) \
+  case i:              \
+    return textureLod(materialArrays[i], uvLayer, lod);
+
+vec4 sample_array(int array, vec3 uvLayer, float lod)
+{
+  switch (array)
+  {
+    SAMPLE_CASE(0)
+    SAMPLE_CASE(1)
+    SAMPLE_CASE(2)
+    SAMPLE_CASE(3)
+    SAMPLE_CASE(4)
+    SAMPLE_CASE(5)
+    SAMPLE_CASE(6)
+    SAMPLE_CASE(7)
+    SAMPLE_CASE(8)
+    SAMPLE_CASE(9)
+    SAMPLE_CASE(10)
+    SAMPLE_CASE(11)
+    SAMPLE_CASE(12)
+    SAMPLE_CASE(13)
+    SAMPLE_CASE(14)
+  default:
+    return textureLod(materialArrays[15], uvLayer, lod);
+  }
+}
 
 void main()
 {
@@ -15,8 +50,23 @@ void main()
   gPosition = FragPos;
   // also store the per-fragment normals into the gbuffer
   gNormal = normalize(Normal);
-  // and the diffuse per-fragment color
-  gAlbedoSpec.rgb = texture(texture_diffuse1, TexCoords).rgb;
+
+  // and the diffuse per-fragment color. Mips still streaming in are skipped
+  // by clamping the lod to the finest one resident
+  Material material = materials[MaterialIndex];
+  vec3 albedo = material.baseColor.rgb;
+  if (material.diffuseArray >= 0 &&
+      material.diffuseLevel < material.diffuseLevels)
+  {
+    vec2 texels = TexCoords * material.diffuseSize;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    lod = max(lod, float(material.diffuseLevel));
+    albedo *= sample_array(material.diffuseArray,
+                           vec3(TexCoords, material.diffuseLayer), lod).rgb;
+  }
+  gAlbedoSpec.rgb = albedo;
   // store specular intensity in gAlbedoSpec's alpha component
   gAlbedoSpec.a = 1.0f;
 }
@@ -1,24 +1,55 @@
 #version 430 core
+#ifndef QUANTIZED_VERTICES
+#error "QUANTIZED_VERTICES define missing"
+#endif
+
+// with QUANTIZED_VERTICES aPos is 0..1 across the mesh bounds, the model
+// matrix scales it back. aNormal is octahedral encoded
 layout(location = 0) in vec3 aPos;
+#if QUANTIZED_VERTICES
+layout(location = 1) in vec2 aNormal;
+#else
 layout(location = 1) in vec3 aNormal;
+#endif
 layout(location = 2) in vec2 aTexCoords;
+// draw index from the instanced id buffer + the draw's baseInstance, see
+// GeometryArena::DRAW_ID_LOCATION
+layout(location = 7) in uint aDrawID;
 
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
+flat out uint MaterialIndex;
+
+#include "include/frame.glsl"
+#include "include/draws.glsl"
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#if QUANTIZED_VERTICES
+vec3 decode_octahedral(vec2 encoded)
+{
+  vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  // unfold the lower hemisphere
+  float t = max(-n.z, 0.0);
+  n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+  return normalize(n);
+}
+#endif
 
 void main()
 {
-  vec4 viewPos = view * model * vec4(aPos, 1.0);
+  DrawData draw = draws[aDrawID];
+  vec4 viewPos = view * draw.model * vec4(aPos, 1.0);
   FragPos = viewPos.xyz;
   TexCoords = aTexCoords;
+  MaterialIndex = draw.material;
 
-  mat3 normalMatrix = transpose(inverse(mat3(view * model)));
-  Normal = normalMatrix * aNormal;
+  // view is rigid, so its own rotation part transforms normals
+#if QUANTIZED_VERTICES
+  vec3 normal = decode_octahedral(aNormal);
+#else
+  vec3 normal = aNormal;
+#endif
+  Normal = mat3(view) * (mat3(draw.normalMatrix) * normal);
 
   gl_Position = projection * viewPos;
 }
@@ -1,42 +1,20 @@
 #version 430 core
 // dependent on simple_screenspace.vert
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D gAlbedoSpec;
-uniform sampler2D ssao;
+// variant features, see Render::light_pass_features
+#ifndef ENABLE_SSAO
+#error "ENABLE_SSAO define missing"
+#endif
 
-struct PointLight
-{
-    vec4 position;
-    vec4 color;
-    float intensity;
-    float radius;
-};
-
-struct Cluster
-{
-    vec4 minPoint;
-    vec4 maxPoint;
-    uint count;
-    uint lightIndices[100];
-};
-
-layout(std430, binding = 1) restrict buffer clusterSSBO {
-    Cluster clusters[];
-};
-layout(std430, binding = 2) restrict buffer lightSSBO
-{
-    PointLight pointLight[];
-};
-
-uniform float zNear;
-uniform float zFar;
-uniform uvec3 gridSize;
-uniform uvec2 screenDimensions;
+layout(binding = 0) uniform sampler2D gPosition;
+layout(binding = 1) uniform sampler2D gNormal;
+layout(binding = 2) uniform sampler2D gAlbedoSpec;
+#if ENABLE_SSAO
+layout(binding = 3) uniform sampler2D ssao;
+#endif
 
-uniform mat4 view;
-uniform bool enableSSAO;
+#include "include/frame.glsl"
+#include "include/clusters.glsl"
 
 out vec4 FragColor;
 
@@ -47,7 +25,11 @@ void main()
     vec3 FragPos = texture(gPosition, TexCoords).rgb;
     vec3 Normal = texture(gNormal, TexCoords).rgb;
     vec3 Diffuse = texture(gAlbedoSpec, TexCoords).rgb;
-    float AmbientOcclusion = enableSSAO ? texture(ssao, TexCoords).r : 1.0f;
+#if ENABLE_SSAO
+    float AmbientOcclusion = texture(ssao, TexCoords).r;
+#else
+    float AmbientOcclusion = 1.0f;
+#endif
 
     vec3 ambient = vec3(Diffuse * AmbientOcclusion * 0.05);
     vec3 lighting = ambient;
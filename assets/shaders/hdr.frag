@@ -7,9 +7,11 @@ in vec2 TexCoords;
 
 uniform sampler2D hdrBuffer;
 
-uniform bool enable;
-uniform float exposure;
-uniform float gamma;
+layout(std140, binding = 3) uniform HDRPassBlock
+{
+    float exposure;
+    float gamma;
+};
 
 float linear_to_srgb(float x)
 {
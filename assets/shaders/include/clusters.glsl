@@ -0,0 +1,37 @@
+// cluster grid and light buffers shared by the cluster build, light cull and
+// lighting passes. Sizes are injected from c++ as defines, see
+// Render::Compute::cluster_defines
+#if !defined(GRID_SIZE_X) || !defined(GRID_SIZE_Y) || !defined(GRID_SIZE_Z)
+#error "cluster grid size defines missing"
+#endif
+#ifndef MAX_LIGHTS_PER_CLUSTER
+#error "MAX_LIGHTS_PER_CLUSTER define missing"
+#endif
+
+const uvec3 gridSize = uvec3(GRID_SIZE_X, GRID_SIZE_Y, GRID_SIZE_Z);
+
+struct PointLight
+{
+    vec4 position;
+    vec4 color;
+    float intensity;
+    float radius;
+};
+
+struct Cluster
+{
+    vec4 minPoint;
+    vec4 maxPoint;
+    uint count;
+    uint lightIndices[MAX_LIGHTS_PER_CLUSTER];
+};
+
+layout(std430, binding = 1) restrict buffer clusterSSBO
+{
+    Cluster clusters[];
+};
+
+layout(std430, binding = 2) restrict buffer lightSSBO
+{
+    PointLight pointLight[];
+};
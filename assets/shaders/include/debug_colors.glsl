@@ -0,0 +1,9 @@
+// colors shared by the debug views
+
+// blue at 0 through green to red at 1
+vec3 heat_color(float t)
+{
+    t = clamp(t, 0.0, 1.0);
+    return t < 0.5 ? mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), t * 2.0)
+                   : mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), t * 2.0 - 1.0);
+}
@@ -0,0 +1,20 @@
+// per draw data of the scene, written by Render::upload_scene_draws. Index
+// matches the draw's command in the indirect buffers
+struct DrawData
+{
+    mat4 model;
+    mat4 normalMatrix; // inverse transpose of model
+    vec4 aabbMin; // world space bounds, w unused
+    vec4 aabbMax;
+    // lod chain, index ranges in the geometry arena
+    uvec4 lodFirstIndex;
+    uvec4 lodIndexCount;
+    vec4 lodError; // world space distance to the full detail surface
+    uint lodCount;
+    uint material; // index into the material library
+};
+
+layout(std430, binding = 3) restrict readonly buffer drawSSBO
+{
+    DrawData draws[];
+};
@@ -0,0 +1,12 @@
+// per frame camera data, uploaded once per frame by
+// Render::update_frame_uniforms. Binding matches UniformBinding::FRAME
+layout(std140, binding = 0) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 inverseView;
+    mat4 inverseProjection;
+    uvec2 screenDimensions; // framebuffer pixel dimensions to be exact
+    float zNear;
+    float zFar;
+};
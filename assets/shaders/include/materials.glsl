@@ -0,0 +1,18 @@
+// materials of every loaded model, written by MaterialLibrary::update. Draws
+// index it with DrawData.material
+struct Material
+{
+    vec4 baseColor;
+    int diffuseArray; // sampler array unit, -1 untextured
+    int diffuseLayer;
+    // finest mip streamed in so far, diffuseLevels while none is
+    int diffuseLevel;
+    int diffuseLevels; // of the array, which has one size
+    vec2 diffuseSize;  // texels of level 0
+    vec2 padding;
+};
+
+layout(std430, binding = 6) restrict readonly buffer materialSSBO
+{
+    Material materials[];
+};
@@ -0,0 +1,64 @@
+#version 430 core
+#if !defined(SHOW_RADIUS) || !defined(COLOR_BY_CLUSTER_COUNT)
+#error "light gizmo feature defines missing"
+#endif
+
+// one instance per light in the light buffer, no instance attributes. With
+// SHOW_RADIUS aPos is the unit sphere scaled to the light radius, otherwise
+// a unit cube scaled to CUBE_SIZE
+layout(location = 0) in vec3 aPos;
+
+flat out vec4 DebugColor;
+
+#include "include/frame.glsl"
+#include "include/clusters.glsl"
+
+const float CUBE_SIZE = 0.5;
+
+#if COLOR_BY_CLUSTER_COUNT
+#include "include/debug_colors.glsl"
+
+const vec4 NO_CLUSTER_COLOR = vec4(0.5, 0.5, 0.5, 1.0);
+
+// light count of the cluster around a view space point, the same lookup as
+// the lighting pass. Gray outside the grid
+vec4 cluster_color(vec3 viewPos)
+{
+    vec4 clip = projection * vec4(viewPos, 1.0);
+    if (-viewPos.z < zNear || -viewPos.z > zFar)
+        return NO_CLUSTER_COLOR;
+    vec2 ndc = clip.xy / clip.w;
+    if (any(greaterThan(abs(ndc), vec2(1.0))))
+        return NO_CLUSTER_COLOR;
+
+    uint zTile = uint((log(-viewPos.z / zNear) * gridSize.z) / log(zFar / zNear));
+    vec2 tileSize = screenDimensions / gridSize.xy;
+    vec2 screenPos = (ndc * 0.5 + 0.5) * vec2(screenDimensions);
+    uvec3 tile = min(uvec3(screenPos / tileSize, zTile), gridSize - 1u);
+    uint tileIndex =
+        tile.x + (tile.y * gridSize.x) + (tile.z * gridSize.x * gridSize.y);
+
+    float load = float(clusters[tileIndex].count) / float(MAX_LIGHTS_PER_CLUSTER);
+    return vec4(heat_color(load), 1.0);
+}
+#endif
+
+void main()
+{
+    PointLight light = pointLight[gl_InstanceID];
+#if SHOW_RADIUS
+    float scale = light.radius;
+#else
+    float scale = CUBE_SIZE;
+#endif
+    vec3 center = (view * vec4(light.position.xyz, 1.0)).xyz;
+    // view is rigid, scaling before or after it is the same
+    vec3 viewPos = center + mat3(view) * (aPos * scale);
+    gl_Position = projection * vec4(viewPos, 1.0);
+
+#if COLOR_BY_CLUSTER_COUNT
+    DebugColor = cluster_color(center);
+#else
+    DebugColor = vec4(light.color.rgb, 1.0);
+#endif
+}
@@ -4,19 +4,32 @@ out float FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D texNoise;
+// variant features, see Render::ssao_features. A constant kernel size lets
+// the sample loop unroll
+#ifndef SSAO_KERNEL_SIZE
+#error "SSAO_KERNEL_SIZE define missing"
+#endif
+const int kernelSize = SSAO_KERNEL_SIZE;
 
-uniform vec3 samples[64];
+layout(binding = 0) uniform sampler2D gPosition;
+layout(binding = 1) uniform sampler2D gNormal;
+layout(binding = 2) uniform sampler2D texNoise;
 
-uniform int kernelSize;
-uniform float radius;
-uniform float bias;
-uniform float power;
+#include "include/frame.glsl"
 
-uniform uvec2 screenDimensions;
-uniform mat4 projection;
+
+// static kernel, uploaded once. vec4 for std140 array stride
+layout(std140, binding = 1) uniform SSAOKernelBlock
+{
+    vec4 samples[64];
+};
+
+layout(std140, binding = 2) uniform SSAOPassBlock
+{
+    float radius;
+    float bias;
+    float power;
+};
 
 void main()
 {
@@ -38,7 +51,7 @@ void main()
     for (int i = 0; i < kernelSize; ++i)
     {
         // get sample position
-        vec3 samplePos = TBN * samples[i]; // from tangent to view-space
+        vec3 samplePos = TBN * samples[i].xyz; // from tangent to view-space
         samplePos = fragPos + samplePos * radius;
 
         // project sample position (to sample texture) (to get position on
@@ -3,9 +3,7 @@
 #include <GLFW/glfw3.h>
 #include <array>
 
-#include <chrono>
 #include <iostream>
-#include <thread>
 #include <tuple>
 
 struct CoreData
@@ -25,7 +23,7 @@ struct CoreData
   float frameStartTime;
   float lastFrameTime;
 
-  int targetFps;
+  FramePacer pacer; // owns the target fps
   int fps; 
   int liveFPS;
 };
@@ -38,6 +36,7 @@ namespace Core
 namespace GL
 {
 void init();
+void update();
 }
 } // namespace Core
 //==========
@@ -248,7 +247,8 @@ void init_window(int width, int height, const char *title)
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
   core.window = window;
-  core.targetFps = glfwGetVideoMode(glfwGetPrimaryMonitor())->refreshRate;
+  core.pacer.set_target_fps(
+      glfwGetVideoMode(glfwGetPrimaryMonitor())->refreshRate);
   core.initial_width = width;
   core.initial_height = height;
 
@@ -256,7 +256,11 @@ void init_window(int width, int height, const char *title)
   GL::init();
 }
 
-void close_window() { glfwTerminate(); }
+void close_window()
+{
+  core.pacer.destroy();
+  glfwTerminate();
+}
 
 void begin_drawing()
 {
@@ -274,6 +278,8 @@ void begin_drawing()
     accum = 0;
   }
   core.liveFPS = 1.0f / core.deltaTime;
+
+  GL::update();
 }
 
 void end_drawing()
@@ -288,23 +294,10 @@ void end_drawing()
 
   glfwPollEvents(); // fire callbacks, updating new states
 
-  double frameEndTime = glfwGetTime();
-  double target = 1.0 / (core.targetFps);
-  double frameTime = frameEndTime - core.lastFrameTime;
-  double remainingTime = target - frameTime;
-
-  if (remainingTime > 0)
-  {
-    auto sleepTime = std::chrono::duration<double>(remainingTime);
-
-    std::this_thread::sleep_for(sleepTime);
-    // busy-wait for the last bit to get more accurate timing
-    while (glfwGetTime() < core.lastFrameTime + target)
-    {
-    }
-  }
-
+  // sleeps instead of spinning, see FramePacer
+  core.pacer.wait();
   glfwSwapBuffers(core.window);
+  core.pacer.frame_submitted();
 }
 
 void toggle_fullscreen()
@@ -353,7 +346,16 @@ bool iswindow_resized() { return core.isWindowResized; }
 
 int get_fps() { return core.fps; }
 int get_live_fps() { return core.liveFPS; }
-int get_targetfps() { return core.targetFps; }
-void set_targetfps(int target) { core.targetFps = target; };
+int get_targetfps() { return core.pacer.get_target_fps(); }
+void set_targetfps(int target) { core.pacer.set_target_fps(target); };
+int get_max_queued_frames() { return core.pacer.get_max_queued_frames(); }
+void set_max_queued_frames(int frames)
+{
+  core.pacer.set_max_queued_frames(frames);
+}
+const FramePacer::Stats &get_frame_pacing_stats()
+{
+  return core.pacer.get_stats();
+}
 
 } // namespace Core
@@ -13,17 +13,44 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/trigonometric.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <tuple>
 #include <vector>
 #include <glm/ext/quaternion_float.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 
+#include "core/frame_pacer.h"
+#include "core/scene_graph.h"
+
 struct Vertex
 {
   glm::vec3 position;
   glm::vec3 normal;
   glm::vec2 texcoord;
 };
+
+// compressed Vertex, 16 bytes instead of 32. Positions are unorm16 across
+// the mesh bounds, Mesh::dequantize maps them back. Normals are octahedral
+// snorm16, texcoords half floats
+struct PackedVertex
+{
+  std::uint16_t position[4]; // w unused
+  std::int16_t normal[2];
+  std::uint16_t texcoord[2];
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+// vertex layout in the geometry arena and the model cache, Vertex is only
+// used while importing. Chosen by the QUANTIZED_VERTICES build option
+#ifndef QUANTIZED_VERTICES
+#define QUANTIZED_VERTICES 0
+#endif
+#if QUANTIZED_VERTICES
+using GPUVertex = PackedVertex;
+#else
+using GPUVertex = Vertex;
+#endif
 class Transform
 {
 private:
@@ -95,22 +122,46 @@ public:
   }
 };
 
+class GeometryArena;
+class TextureStreamer;
+class MaterialLibrary;
+
 // Mesh is not a general API. Mesh is for loading from model loaders.
+// Geometry lives in the shared GeometryArena, a mesh is a range of it
 class Mesh
 {
 
 public:
-  unsigned int diffuseTextureID{}, specularTextureID{};
-  unsigned int vao{}, vbo{}, ebo{};
+  std::uint32_t material{}; // MaterialLibrary index
+  unsigned int vao{}; // the arena vao, same for every mesh
+  int baseVertex{};
+  unsigned int firstIndex{};
   unsigned int triangleCount{};
   unsigned int indicesCount{};
-
-  Transform transform;
+  glm::vec3 aabbMin{}, aabbMax{}; // local space bounds
+  // arena positions to local space, folded into the model matrix when
+  // drawing. Identity unless vertices are quantized
+  glm::mat4 dequantize{1.0f};
+
+  // level of detail chain, lod 0 is the full range above. Coarser levels
+  // index the same vertices
+  static constexpr int MAX_LODS = 4;
+  struct Lod
+  {
+    unsigned int firstIndex{};
+    unsigned int indicesCount{};
+    float error{}; // local space distance to the full detail surface
+  };
+  Lod lods[MAX_LODS]{};
+  int lodCount{};
+
+  std::uint32_t node{}; // in the model's scene graph, gives the transform
 };
 
 struct Model
 {
   std::vector<Mesh> meshes;
+  SceneGraph scene; // node hierarchy of the source file
 };
 
 namespace Core
@@ -131,6 +182,11 @@ int get_fps();      // fps delayed update for friendly displaying
 int get_live_fps(); // instantaneous fps
 int get_targetfps();
 void set_targetfps(int target);
+// frames the gpu may queue behind the cpu before end_drawing waits on it, 0
+// to never wait
+int get_max_queued_frames();
+void set_max_queued_frames(int frames);
+const FramePacer::Stats &get_frame_pacing_stats();
 
 std::tuple<int, int> get_framebuffer_size();
 std::tuple<int, int> get_inital_window_dimensions();
@@ -153,19 +209,24 @@ std::tuple<double, double> get_mouse_pos_delta();
 namespace GL
 {
 Model load_gltf(const char *path);
+// every loaded mesh is suballocated from this. Created on first use
+GeometryArena &get_geometry_arena();
+// background texture uploads, drained once per frame. Created on first use
+TextureStreamer &get_texture_streamer();
+// materials and texture arrays of every loaded model. Created on first use
+MaterialLibrary &get_material_library();
 unsigned int load_texture(const char *path, bool isLinear);
 
-void draw_mesh_instanced(std::vector<glm::mat4> matrixes, unsigned int IBO,
-                         const Mesh &srcMesh);
-
 void render_fullscreen_quad();
 
-// simple vertex only meshes.
+// simple vertex only meshes
 void draw_cube();
-void draw_cube(const std::vector<Transform> &instances);
-
 void draw_sphere();
-void draw_sphere(const std::vector<Transform> &instances);
+
+// instances without per instance attributes, for shaders that pull their
+// data from a buffer by gl_InstanceID
+void draw_cube_instanced(std::size_t instanceCount);
+void draw_sphere_instanced(std::size_t instanceCount);
 
 } // namespace GL
 
@@ -0,0 +1,188 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include <chrono>
+#else
+#include <cerrno>
+#include <ctime>
+#endif
+
+// per frame weight of a new sample in the reported stats
+constexpr double STATS_SMOOTHING = 0.05;
+// the wake-up error estimate rises fast and decays slowly, a missed deadline
+// costs more than yielding a little longer
+constexpr double WAKE_ERROR_RISE = 0.5;
+constexpr double WAKE_ERROR_DECAY = 0.02;
+// one preempted sleep must not turn into yielding for whole frames
+constexpr std::int64_t MAX_WAKE_ERROR_NS = 4'000'000;
+
+#ifdef _WIN32
+
+// steady_clock is the performance counter
+static std::int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static void sleep_until(std::int64_t time)
+{
+  // high resolution timers don't round up to the scheduler tick. Older
+  // windows falls back to a normal one
+  static HANDLE timer = []
+  {
+    HANDLE highResolution = CreateWaitableTimerExW(
+        nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+        TIMER_ALL_ACCESS);
+    return highResolution ? highResolution
+                          : CreateWaitableTimerExW(nullptr, nullptr, 0,
+                                                   TIMER_ALL_ACCESS);
+  }();
+
+  const std::int64_t remaining = time - now_ns();
+  if (remaining <= 0 || !timer)
+    return;
+  LARGE_INTEGER due{};
+  due.QuadPart = -(remaining / 100); // relative, in 100 ns units
+  if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE))
+    WaitForSingleObject(timer, INFINITE);
+}
+
+#else
+
+static std::int64_t now_ns()
+{
+  timespec time{};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1'000'000'000LL + time.tv_nsec;
+}
+
+static void sleep_until(std::int64_t time)
+{
+  timespec until{};
+  until.tv_sec = time / 1'000'000'000;
+  until.tv_nsec = time % 1'000'000'000;
+  // absolute, so a signal cutting the sleep short just sleeps again
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) ==
+         EINTR)
+  {
+  }
+}
+
+#endif
+
+static void smooth(double &value, double sample)
+{
+  value += (sample - value) * STATS_SMOOTHING;
+}
+
+void FramePacer::destroy()
+{
+  for (GLsync fence : fences)
+    glDeleteSync(fence);
+  fences.clear();
+}
+
+void FramePacer::set_target_fps(int fps)
+{
+  targetFps = std::max(fps, 0);
+  periodNs = targetFps > 0 ? 1'000'000'000LL / targetFps : 0;
+}
+
+void FramePacer::set_max_queued_frames(int frames)
+{
+  maxQueuedFrames = std::max(frames, 0);
+}
+
+void FramePacer::sleep_until_deadline()
+{
+  const std::int64_t wakeAt = deadline - wakeErrorNs;
+  if (now_ns() < wakeAt)
+  {
+    sleep_until(wakeAt);
+    const std::int64_t late = std::max<std::int64_t>(0, now_ns() - wakeAt);
+    const double rate = late > wakeErrorNs ? WAKE_ERROR_RISE : WAKE_ERROR_DECAY;
+    wakeErrorNs += static_cast<std::int64_t>((late - wakeErrorNs) * rate);
+    wakeErrorNs = std::clamp<std::int64_t>(wakeErrorNs, 0, MAX_WAKE_ERROR_NS);
+  }
+  // only the calibrated wake-up error is left, usually tens of microseconds
+  while (now_ns() < deadline)
+    std::this_thread::yield();
+}
+
+void FramePacer::wait()
+{
+  const std::int64_t start = now_ns();
+  const std::int64_t target = deadline;
+  if (periodNs == 0)
+  {
+    deadline = 0;
+  }
+  else if (deadline == 0 || start - deadline > periodNs)
+  {
+    // first frame, or so late that catching up would rush several frames.
+    // Count from now instead
+    deadline = start;
+  }
+  else if (start < deadline)
+  {
+    sleep_until_deadline();
+  }
+
+  const std::int64_t frameStart = now_ns();
+  idleNs += frameStart - start;
+  if (lastFrameStart != 0)
+  {
+    const double frameNs = static_cast<double>(frameStart - lastFrameStart);
+    const double jitterNs =
+        target != 0 && periodNs != 0 ? std::llabs(frameStart - target) : 0;
+    smooth(stats.jitterMs, jitterNs / 1e6);
+    smooth(stats.idleFraction, frameNs > 0 ? std::min(1.0, idleNs / frameNs)
+                                           : 0.0);
+  }
+  stats.wakeErrorMs = wakeErrorNs / 1e6;
+  lastFrameStart = frameStart;
+  idleNs = 0;
+  if (periodNs != 0)
+    deadline += periodNs;
+}
+
+void FramePacer::frame_submitted()
+{
+  if (maxQueuedFrames == 0)
+  {
+    destroy();
+    stats.fenceWaitMs = 0;
+    return;
+  }
+
+  fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+  const std::int64_t start = now_ns();
+  while (fences.size() > static_cast<std::size_t>(maxQueuedFrames))
+  {
+    // the driver blocks in here, the flush makes sure the fence can signal
+    GLsync oldest = fences.front();
+    while (glClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            100'000'000) == GL_TIMEOUT_EXPIRED)
+    {
+    }
+    glDeleteSync(oldest);
+    fences.pop_front();
+  }
+  const std::int64_t waited = now_ns() - start;
+  idleNs += waited;
+  smooth(stats.fenceWaitMs, waited / 1e6);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <gldoc.hpp>
+
+// holds the frame loop to a target rate without spinning a core. Each frame
+// sleeps until an absolute deadline (clock_nanosleep with TIMER_ABSTIME, a
+// high resolution waitable timer on windows), waking early by the measured
+// scheduler wake-up error, which is recalibrated every sleep. Only that last
+// sliver is yielded away. Deadlines advance by the period, so frame starts
+// don't drift with how long a frame took. Optionally also caps how many
+// frames the gpu may have queued behind the cpu, waiting on fences
+class FramePacer
+{
+public:
+  struct Stats
+  {
+    // smoothed over the last frames
+    double jitterMs = 0;     // |frame start - deadline|
+    double idleFraction = 0; // share of the frame spent sleeping or waiting
+    double fenceWaitMs = 0;  // waiting on the gpu per frame
+    double wakeErrorMs = 0;  // current calibrated wake-up lateness
+  };
+
+private:
+  std::int64_t periodNs = 0; // 0 unlimited
+  std::int64_t deadline = 0; // start of the next frame, 0 unset
+  std::int64_t lastFrameStart = 0;
+  std::int64_t wakeErrorNs = 500'000;
+  std::int64_t idleNs = 0; // this frame so far
+  int targetFps = 0;
+
+  int maxQueuedFrames = 0; // 0 no fence pacing
+  std::deque<GLsync> fences; // oldest first
+
+  Stats stats;
+
+  void sleep_until_deadline();
+
+public:
+  void destroy();
+
+  // 0 or less for no limit
+  void set_target_fps(int fps);
+  int get_target_fps() const { return targetFps; }
+  // frames the gpu may lag behind, 0 to not wait on it at all
+  void set_max_queued_frames(int frames);
+  int get_max_queued_frames() const { return maxQueuedFrames; }
+
+  // right before swapping: wait for the frame's deadline
+  void wait();
+  // right after swapping: fence the frame, wait while too many are queued
+  void frame_submitted();
+
+  const Stats &get_stats() const { return stats; }
+};
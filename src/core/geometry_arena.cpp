@@ -0,0 +1,143 @@
+#include "geometry_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <gldoc.hpp>
+#include <numeric>
+#include <vector>
+
+// replace buffer with a bigger one, keeping the first usedBytes
+static void grow_buffer(unsigned int &buffer, std::size_t usedBytes,
+                        std::size_t newBytes)
+{
+  unsigned int newBuffer;
+  glGenBuffers(1, &newBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+
+  if (buffer && usedBytes > 0)
+  {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        usedBytes);
+  }
+  if (buffer)
+    glDeleteBuffers(1, &buffer);
+  buffer = newBuffer;
+}
+
+void GeometryArena::create() { glGenVertexArrays(1, &vao); }
+
+void GeometryArena::destroy()
+{
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vbo);
+  glDeleteBuffers(1, &ebo);
+  glDeleteBuffers(1, &drawIdBuffer);
+  *this = GeometryArena{};
+}
+
+void GeometryArena::bind_vertex_buffer()
+{
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+#if QUANTIZED_VERTICES
+  // normalized integers come out as floats, the shader decodes the normal
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(GPUVertex),
+                        (void *)offsetof(GPUVertex, position));
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(GPUVertex),
+                        (void *)offsetof(GPUVertex, normal));
+
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(GPUVertex),
+                        (void *)offsetof(GPUVertex, texcoord));
+#else
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void *)offsetof(Vertex, normal));
+
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void *)offsetof(Vertex, texcoord));
+#endif
+}
+
+void GeometryArena::reserve(std::size_t vertices, std::size_t indices)
+{
+  if (vertexCount + vertices > vertexCapacity)
+  {
+    vertexCapacity = std::max(vertexCount + vertices, vertexCapacity * 2);
+    grow_buffer(vbo, vertexCount * sizeof(GPUVertex),
+                vertexCapacity * sizeof(GPUVertex));
+    bind_vertex_buffer();
+  }
+  if (indexCount + indices > indexCapacity)
+  {
+    indexCapacity = std::max(indexCount + indices, indexCapacity * 2);
+    grow_buffer(ebo, indexCount * sizeof(unsigned int),
+                indexCapacity * sizeof(unsigned int));
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo); // element buffer is vao state
+  }
+}
+
+GeometryArena::Allocation GeometryArena::add(const GPUVertex *vertices,
+                                             std::size_t newVertexCount,
+                                             const unsigned int *indices,
+                                             std::size_t newIndexCount)
+{
+  reserve(newVertexCount, newIndexCount);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, vertexCount * sizeof(GPUVertex),
+                  newVertexCount * sizeof(GPUVertex), vertices);
+
+  // indices stay mesh local, baseVertex offsets them at draw time
+  Allocation allocation{static_cast<int>(vertexCount),
+                        add_indices(indices, newIndexCount)};
+  vertexCount += newVertexCount;
+  return allocation;
+}
+
+unsigned int GeometryArena::add_indices(const unsigned int *indices,
+                                        std::size_t count)
+{
+  reserve(0, count);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int),
+                  count * sizeof(unsigned int), indices);
+
+  unsigned int firstIndex = static_cast<unsigned int>(indexCount);
+  indexCount += count;
+  return firstIndex;
+}
+
+void GeometryArena::reserve_draw_ids(std::size_t drawCount)
+{
+  if (drawCount <= drawIdCapacity)
+    return;
+  drawIdCapacity = std::max(drawCount, drawIdCapacity * 2);
+
+  std::vector<std::uint32_t> ids(drawIdCapacity);
+  std::iota(ids.begin(), ids.end(), 0u);
+
+  if (!drawIdBuffer)
+    glGenBuffers(1, &drawIdBuffer);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+  glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(std::uint32_t), ids.data(),
+               GL_STATIC_DRAW);
+
+  glEnableVertexAttribArray(DRAW_ID_LOCATION);
+  glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT,
+                         sizeof(std::uint32_t), (void *)0);
+  glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "core/core.h"
+
+#include <cstddef>
+
+// one vertex buffer and one index buffer that every loaded mesh is
+// suballocated from, drawn through a single vao. Meshes only keep offsets
+// into it, so a whole scene can be submitted with multi draw indirect
+// without rebinding anything
+class GeometryArena
+{
+private:
+  unsigned int vao = 0, vbo = 0, ebo = 0;
+  unsigned int drawIdBuffer = 0;
+  std::size_t vertexCapacity = 0, indexCapacity = 0, drawIdCapacity = 0;
+  std::size_t vertexCount = 0, indexCount = 0;
+
+  void bind_vertex_buffer();
+
+public:
+  // the instanced draw id attribute. Holds 0, 1, 2 ... so with a draw's
+  // baseInstance set to its index, the vertex shader gets the draw index.
+  // gl_DrawID would need GL 4.6 or ARB_shader_draw_parameters
+  static constexpr unsigned int DRAW_ID_LOCATION = 7;
+
+  struct Allocation
+  {
+    int baseVertex;
+    unsigned int firstIndex;
+  };
+
+  void create();
+  void destroy();
+
+  // make room up front so the next adds don't reallocate and copy
+  void reserve(std::size_t vertices, std::size_t indices);
+  Allocation add(const GPUVertex *vertices, std::size_t vertexCount,
+                 const unsigned int *indices, std::size_t indexCount);
+  // more indices for vertices added before, e.g. a level of detail. Returns
+  // the first index, draw with the baseVertex of the vertices
+  unsigned int add_indices(const unsigned int *indices, std::size_t count);
+
+  // ensure draw ids 0..drawCount-1 exist
+  void reserve_draw_ids(std::size_t drawCount);
+
+  unsigned int get_vao() const { return vao; }
+  std::size_t get_vertex_count() const { return vertexCount; }
+  std::size_t get_index_count() const { return indexCount; }
+};
@@ -1,15 +1,26 @@
 #include "core.h"
 #include "core/util.h"
-
+#include "core/thread_pool.h"
+#include "core/mapped_file.h"
+#include "core/model_cache.h"
+#include "core/geometry_arena.h"
+#include "core/mesh_optimizer.h"
+#include "core/texture_compress.h"
+#include "core/texture_streamer.h"
+#include "core/material_library.h"
+
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
+#include <limits>
 #include <gldoc.hpp>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/common.hpp>
 #include <glm/ext/quaternion_common.hpp>
 #include <glm/ext/quaternion_float.hpp>
 #include <glm/ext/quaternion_transform.hpp>
@@ -25,7 +36,10 @@
 #include <glm/gtx/quaternion.hpp>
 #include <iostream>
 
+#include <chrono>
 #include <cmath>
+#include <memory>
+#include <mutex>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
@@ -54,26 +68,43 @@ static Image load_image_from_memory(const unsigned char *rawData, int len)
   }
   return image;
 }
+// decodes straight from a mapping of the file, stbi_load would buffer the
+// whole file on the heap first
 static Image load_image(const char *path)
 {
-  Image image{};
-  image.data =
-      stbi_load(path, &image.width, &image.height, &image.numChannels, 0);
-  if (!image.data)
+  MappedFile file;
+  if (!file.open(path) ||
+      file.size() > static_cast<std::size_t>(std::numeric_limits<int>::max()))
   {
     std::cerr << "Failed to load image from path: " << path << std::endl;
+    return {};
   }
-  return image;
+  return load_image_from_memory(file.data(), static_cast<int>(file.size()));
 }
 static void free_image(Image &image) { stbi_image_free(image.data); }
 
-static unsigned int create_gltexture(Image &image, bool isLinearColorSpace)
+// s3tc is an extension, supported by every desktop driver in practice.
+// GL thread only
+static bool has_s3tc()
 {
-  int numChannels = image.numChannels;
-  int width = image.width;
-  int height = image.height;
-  unsigned char *data = image.data;
+  static const bool supported = []
+  {
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; ++i)
+    {
+      const char *name =
+          reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+      if (name && std::string_view(name) == "GL_EXT_texture_compression_s3tc")
+        return true;
+    }
+    return false;
+  }();
+  return supported;
+}
 
+static GLuint gen_texture()
+{
   GLuint textureID;
   glGenTextures(1, &textureID);
   glBindTexture(GL_TEXTURE_2D, textureID);
@@ -84,31 +115,204 @@ static unsigned int create_gltexture(Image &image, bool isLinearColorSpace)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                   GL_LINEAR_MIPMAP_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return textureID;
+}
+
+static unsigned int create_gltexture(Image &image, bool isLinearColorSpace)
+{
+  GLuint textureID = gen_texture();
+  auto [format, internalFormat] =
+      get_texture_formats(image.numChannels, isLinearColorSpace);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rgb rows are not 4 byte aligned
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0,
+               format, GL_UNSIGNED_BYTE, image.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  glGenerateMipmap(GL_TEXTURE_2D);
+  return textureID;
+}
 
-  auto format = GL_RGB;
-  auto internalFormat = GL_RGB;
+// an image decoded and mipmapped on a worker thread, waiting for upload
+struct DecodedTexture
+{
+  struct Level
+  {
+    int width, height;
+    std::vector<unsigned char> data;
+  };
+
+  const cgltf_image *source = nullptr;
+  bool isLinear = false;
+  int numChannels = 0;
+  TextureCompress::Format format = TextureCompress::Format::NONE;
+  std::vector<Level> levels; // empty if decoding failed
+  std::size_t uncompressedBytes = 0;
+  double decodeMs = 0;
+};
 
-  if (numChannels == 1) // always assumed linear color space
+// srgb <-> linear so mips of color textures are averaged in linear space,
+// like glGenerateMipmap does for srgb formats
+static float srgb_to_linear(unsigned char value)
+{
+  static const std::array<float, 256> table = []
   {
-    format = GL_RED;
-    internalFormat = GL_RED;
+    std::array<float, 256> t{};
+    for (int i = 0; i < 256; ++i)
+    {
+      float c = i / 255.0f;
+      t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return t;
+  }();
+  return table[value];
+}
+static unsigned char linear_to_srgb(float value)
+{
+  float c = value <= 0.0031308f
+                ? value * 12.92f
+                : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+  return static_cast<unsigned char>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// channels averaged in linear space. Alpha and 1-2 channel images are
+// always linear
+static int srgb_channel_count(const DecodedTexture &texture)
+{
+  const int channels = texture.numChannels;
+  return texture.isLinear || channels < 3 ? 0 : std::min(channels, 3);
+}
+
+// 2x2 box filter. Odd edges clamp to the last texel
+static DecodedTexture::Level downsample(const DecodedTexture::Level &src,
+                                        int channels, int srgbChannels)
+{
+  DecodedTexture::Level dst{};
+  dst.width = std::max(1, src.width / 2);
+  dst.height = std::max(1, src.height / 2);
+  dst.data.resize(std::size_t(dst.width) * dst.height * channels);
+
+  for (int y = 0; y < dst.height; ++y)
+  {
+    const int y0 = std::min(y * 2, src.height - 1);
+    const int y1 = std::min(y * 2 + 1, src.height - 1);
+    for (int x = 0; x < dst.width; ++x)
+    {
+      const int x0 = std::min(x * 2, src.width - 1);
+      const int x1 = std::min(x * 2 + 1, src.width - 1);
+      const unsigned char *texels[4] = {
+          &src.data[(std::size_t(y0) * src.width + x0) * channels],
+          &src.data[(std::size_t(y0) * src.width + x1) * channels],
+          &src.data[(std::size_t(y1) * src.width + x0) * channels],
+          &src.data[(std::size_t(y1) * src.width + x1) * channels]};
+      unsigned char *out =
+          &dst.data[(std::size_t(y) * dst.width + x) * channels];
+
+      for (int c = 0; c < channels; ++c)
+      {
+        if (c < srgbChannels)
+        {
+          float sum = 0;
+          for (const unsigned char *t : texels)
+            sum += srgb_to_linear(t[c]);
+          out[c] = linear_to_srgb(sum * 0.25f);
+        }
+        else
+        {
+          int sum = 0;
+          for (const unsigned char *t : texels)
+            sum += t[c];
+          out[c] = static_cast<unsigned char>((sum + 2) / 4);
+        }
+      }
+    }
   }
-  else if (numChannels == 3)
+  return dst;
+}
+
+// mip chain of the base level down to 1x1
+static void generate_mips(DecodedTexture &texture)
+{
+  const int srgbChannels = srgb_channel_count(texture);
+  while (texture.levels.back().width > 1 || texture.levels.back().height > 1)
+    texture.levels.push_back(downsample(texture.levels.back(),
+                                        texture.numChannels, srgbChannels));
+}
+
+// grey and grey alpha images to rgb and rgba, so color textures always
+// block compress. Base level only, before mips
+static void expand_channels(DecodedTexture &texture)
+{
+  const int channels = texture.numChannels;
+  if (channels >= 3)
+    return;
+  const int expanded = channels + 2;
+  DecodedTexture::Level &base = texture.levels.front();
+  std::vector<unsigned char> data(base.data.size() / channels * expanded);
+  for (std::size_t i = 0, o = 0; i < base.data.size(); i += channels)
   {
-    format = GL_RGB;
-    internalFormat = isLinearColorSpace ? GL_RGB : GL_SRGB;
+    data[o++] = base.data[i];
+    data[o++] = base.data[i];
+    data[o++] = base.data[i];
+    if (channels == 2)
+      data[o++] = base.data[i + 1];
   }
-  else if (numChannels == 4)
+  base.data = std::move(data);
+  texture.numChannels = expanded;
+}
+
+// halve the base level with the mip filter until it fits in maxSize. Other
+// sizes are kept, the material library has an array per size
+static void limit_texture_size(DecodedTexture &texture, int maxSize)
+{
+  const int channels = texture.numChannels;
+  const int srgbChannels = srgb_channel_count(texture);
+  DecodedTexture::Level &level = texture.levels.front();
+  while (level.width > maxSize || level.height > maxSize)
+    level = downsample(level, channels, srgbChannels);
+}
+
+// block compress every level in place. Worker thread
+static void compress_texture(DecodedTexture &texture, bool s3tc)
+{
+  using namespace TextureCompress;
+  const DecodedTexture::Level &base = texture.levels.front();
+  bool hasAlpha = false;
+  if (texture.numChannels == 4)
   {
-    format = GL_RGBA;
-    internalFormat = isLinearColorSpace ? GL_RGBA : GL_SRGB_ALPHA;
+    for (std::size_t i = 3; i < base.data.size() && !hasAlpha; i += 4)
+      hasAlpha = base.data[i] != 255;
   }
+  Role role = texture.isLinear ? Role::DATA : Role::COLOR;
+  texture.format = choose_format(role, texture.numChannels, hasAlpha, s3tc);
+  if (texture.format == Format::NONE)
+    return;
 
-  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format,
-               GL_UNSIGNED_BYTE, data);
+  for (DecodedTexture::Level &level : texture.levels)
+  {
+    std::vector<unsigned char> blocks(level_size(
+        texture.format, level.width, level.height, texture.numChannels));
+    compress(texture.format, level.data.data(), level.width, level.height,
+             texture.numChannels, blocks.data());
+    level.data = std::move(blocks);
+  }
+}
 
-  glGenerateMipmap(GL_TEXTURE_2D);
-  return textureID;
+// hand a decoded chain to the material library, which streams it into an
+// array layer. The upload keeps the data alive until its last level is done
+static void submit_material_texture(
+    std::uint32_t slot, const std::shared_ptr<const DecodedTexture> &texture)
+{
+  TextureData data{};
+  data.width = texture->levels.front().width;
+  data.height = texture->levels.front().height;
+  data.numChannels = texture->numChannels;
+  data.isLinear = texture->isLinear;
+  data.format = texture->format;
+  for (const DecodedTexture::Level &level : texture->levels)
+    data.levels.push_back(level.data.data());
+  data.owner = texture;
+  Core::GL::get_material_library().submit(slot, std::move(data));
 }
 
 // parentDir is the directory the gltf model lives in
@@ -123,12 +327,7 @@ static Image load_cgltf_image(const cgltf_image *image,
         static_cast<const unsigned char *>(buffer_view->buffer->data) +
         buffer_view->offset;
 
-    Image i = load_image_from_memory(rawImageData, buffer_view->size);
-
-    printf(
-        "Loading embedded image: size on disk (%d kb), width %d, height %d\n",
-        static_cast<int>(buffer_view->size / 1000), i.width, i.height);
-    return i;
+    return load_image_from_memory(rawImageData, buffer_view->size);
   }
 
   // Load external image
@@ -147,7 +346,6 @@ static Image load_cgltf_image(const cgltf_image *image,
                 << " does not exist on the filesystem." << std::endl;
     }
 
-    std::cout << "Loading external image from:  " << combinedPath << std::endl;
     return load_image(combinedPath.c_str());
   }
 
@@ -156,43 +354,12 @@ static Image load_cgltf_image(const cgltf_image *image,
   return {};
 }
 
-static Transform get_node_transform(const cgltf_node &node)
+// local matrix of a node, given directly or composed from its trs
+static glm::mat4 get_node_matrix(const cgltf_node &node)
 {
-  Transform t{};
-
-  if (node.has_matrix)
-  {
-    glm::mat4 mat4 = glm::make_mat4(node.matrix);
-
-    glm::vec3 scale;
-    glm::quat rotation;
-    glm::vec3 translation;
-    glm::vec3 skew;
-    glm::vec4 perspective;
-    glm::decompose(mat4, scale, rotation, translation, skew, perspective);
-
-    t = {translation, scale, rotation};
-  }
-  else
-  {
-
-    if (node.has_translation)
-    {
-      t.set_position(glm::make_vec3(node.translation));
-    }
-
-    if (node.has_rotation)
-    {
-      t.set_rotation(glm::make_quat(node.rotation));
-    }
-
-    if (node.has_scale)
-    {
-      t.set_scale(glm::make_vec3(node.scale));
-    }
-  }
-
-  return t;
+  float matrix[16];
+  cgltf_node_transform_local(&node, matrix);
+  return glm::make_mat4(matrix);
 }
 // check if the mesh data we want is there.
 // after check, can assume meshes will be trianglulated and have indices,
@@ -216,8 +383,8 @@ static bool check_mesh(const cgltf_mesh &mesh)
       return false;
     }
 
-    // position not here, assumed to always have position
-    bool hasNormal, hasTexcoord = false;
+    // only set 0 counts, the same rule as find_attribute
+    bool hasPosition = false, hasNormal = false, hasTexcoord = false;
     // check vertex attributes
     for (size_t k = 0; k < primitive.attributes_count; ++k)
     {
@@ -232,11 +399,23 @@ static bool check_mesh(const cgltf_mesh &mesh)
         return false;
       }
 
-      if (attribute.type == cgltf_attribute_type_normal)
+      if (attribute.type == cgltf_attribute_type_position &&
+          attribute.index == 0)
+        hasPosition = true;
+      if (attribute.type == cgltf_attribute_type_normal && attribute.index == 0)
         hasNormal = true;
-      if (attribute.type == cgltf_attribute_type_texcoord)
+      if (attribute.type == cgltf_attribute_type_texcoord &&
+          attribute.index == 0)
         hasTexcoord = true;
     }
+    // position is optional in gltf, such primitives have nothing to draw and
+    // are skipped by the loader
+    if (!hasPosition)
+    {
+      std::cout << "Mesh Check: Primitive without position skipped"
+                << std::endl;
+      continue;
+    }
     if (!hasNormal || !hasTexcoord)
     {
       std::cout << "Mesh Check:: Primitive doesn't have either "
@@ -248,98 +427,570 @@ static bool check_mesh(const cgltf_mesh &mesh)
   return true;
 }
 
-static void
-load_primitive_vertices_and_indices(cgltf_primitive *primitive,
-                                    std::vector<Vertex> &vertices,
-                                    std::vector<unsigned int> &indices)
+// copy one float attribute of every vertex into its slot of the interleaved
+// Vertex array. Float accessors backed by a loaded buffer view (tightly
+// packed or strided) are copied directly, N floats per vertex. Anything else,
+// e.g. sparse accessors, goes through cgltf's per element reader
+template <int N>
+static void extract_float_attribute(const cgltf_accessor *accessor,
+                                    std::size_t memberOffset, Vertex *vertices,
+                                    std::size_t vertexCount)
+{
+  auto *dst = reinterpret_cast<unsigned char *>(vertices) + memberOffset;
+  const std::size_t count = std::min<std::size_t>(accessor->count, vertexCount);
+
+  const uint8_t *src = nullptr;
+  if (!accessor->is_sparse && accessor->buffer_view &&
+      accessor->component_type == cgltf_component_type_r_32f &&
+      cgltf_num_components(accessor->type) == N)
+    src = cgltf_buffer_view_data(accessor->buffer_view);
+
+  if (src)
+  {
+    src += accessor->offset;
+    for (std::size_t i = 0; i < count; ++i)
+      std::memcpy(dst + i * sizeof(Vertex), src + i * accessor->stride,
+                  N * sizeof(float));
+    return;
+  }
+
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    float element[N];
+    cgltf_accessor_read_float(accessor, i, element, N);
+    std::memcpy(dst + i * sizeof(Vertex), element, N * sizeof(float));
+  }
+}
+
+static const cgltf_accessor *find_attribute(const cgltf_primitive &primitive,
+                                            cgltf_attribute_type type)
+{
+  for (size_t i = 0; i < primitive.attributes_count; ++i)
+  {
+    const cgltf_attribute &attribute = primitive.attributes[i];
+    if (attribute.type == type && attribute.index == 0)
+      return attribute.data;
+  }
+  return nullptr;
+}
+
+// vertices must hold the position accessor's count, see check_mesh for what
+// attributes can be assumed present
+static void load_primitive_vertices(const cgltf_primitive &primitive,
+                                    Vertex *vertices, std::size_t vertexCount)
+{
+  extract_float_attribute<3>(
+      find_attribute(primitive, cgltf_attribute_type_position),
+      offsetof(Vertex, position), vertices, vertexCount);
+  extract_float_attribute<3>(
+      find_attribute(primitive, cgltf_attribute_type_normal),
+      offsetof(Vertex, normal), vertices, vertexCount);
+  extract_float_attribute<2>(
+      find_attribute(primitive, cgltf_attribute_type_texcoord),
+      offsetof(Vertex, texcoord), vertices, vertexCount);
+}
+
+// indices must hold the index accessor's count. cgltf unpacks 8/16/32 bit
+// indices in bulk, the per element reader is only for sparse accessors
+static void load_primitive_indices(const cgltf_primitive &primitive,
+                                   unsigned int *indices)
+{
+  const cgltf_accessor *accessor = primitive.indices;
+  if (cgltf_accessor_unpack_indices(accessor, indices, sizeof(unsigned int),
+                                    accessor->count) == accessor->count)
+    return;
+
+  for (size_t i = 0; i < accessor->count; ++i)
+    cgltf_accessor_read_uint(accessor, i, &indices[i], 1);
+}
+
+// reorder the indices in place for the post transform cache and overdraw,
+// then put the vertices in first use order, dropping unused ones. Runs
+// before lods are generated, so they index the optimized vertex order too
+static void optimize_mesh(std::vector<Vertex> &vertices,
+                          unsigned int *indices, std::size_t indexCount)
+{
+  const std::size_t vertexCount = vertices.size();
+  MeshOptimizer::VertexCacheStatistics before =
+      MeshOptimizer::analyze_vertex_cache(indices, indexCount, vertexCount);
+
+  std::vector<unsigned int> source(indices, indices + indexCount);
+  MeshOptimizer::optimize_overdraw(indices, source.data(), indexCount,
+                                   vertices.data(), vertexCount);
+
+  std::vector<unsigned int> remap(vertexCount);
+  std::size_t usedCount = MeshOptimizer::optimize_vertex_fetch_remap(
+      remap.data(), indices, indexCount, vertexCount);
+  MeshOptimizer::remap_index_buffer(indices, indexCount, remap.data());
+  std::vector<Vertex> sourceVertices(vertices);
+  MeshOptimizer::remap_vertex_buffer(vertices.data(), sourceVertices.data(),
+                                     vertexCount, remap.data());
+  vertices.resize(usedCount);
+
+  MeshOptimizer::VertexCacheStatistics after =
+      MeshOptimizer::analyze_vertex_cache(indices, indexCount, usedCount);
+  printf("Vertex cache: ACMR %.2f -> %.2f, ATVR %.2f -> %.2f\n", before.acmr,
+         after.acmr, before.atvr, after.atvr);
+}
+
+static void compute_bounds(const std::vector<Vertex> &vertices,
+                           glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+  boundsMin = boundsMax = glm::vec3(0.0f);
+  if (vertices.empty())
+    return;
+  boundsMin = boundsMax = vertices[0].position;
+  for (const Vertex &vertex : vertices)
+  {
+    boundsMin = glm::min(boundsMin, vertex.position);
+    boundsMax = glm::max(boundsMax, vertex.position);
+  }
+}
+
+// convert to the arena layout and append to the cache, returns the offset
+static std::uint64_t store_vertices(ModelCache::Writer &writer,
+                                    const std::vector<Vertex> &vertices,
+                                    const glm::vec3 &boundsMin,
+                                    const glm::vec3 &boundsMax)
+{
+  std::uint64_t offset = writer.allocate(vertices.size() * sizeof(GPUVertex));
+  auto *destination = reinterpret_cast<GPUVertex *>(writer.at(offset));
+#if QUANTIZED_VERTICES
+  MeshOptimizer::quantize_vertices(destination, vertices.data(),
+                                   vertices.size(), boundsMin, boundsMax);
+#else
+  std::copy(vertices.begin(), vertices.end(), destination);
+#endif
+  return offset;
+}
+
+// copy into the geometry arena, the mesh keeps its range. Vertices are in
+// the arena layout, the bounds are local space
+static Mesh create_mesh(const GPUVertex *vertices, std::size_t vertexCount,
+                        const unsigned int *indices, std::size_t indexCount,
+                        const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+  GeometryArena &arena = Core::GL::get_geometry_arena();
+  GeometryArena::Allocation allocation =
+      arena.add(vertices, vertexCount, indices, indexCount);
+
+  Mesh mesh{};
+  mesh.vao = arena.get_vao();
+  mesh.baseVertex = allocation.baseVertex;
+  mesh.firstIndex = allocation.firstIndex;
+  mesh.triangleCount = indexCount / 3;
+  mesh.indicesCount = indexCount;
+  mesh.lods[0] = {mesh.firstIndex, mesh.indicesCount, 0.0f};
+  mesh.lodCount = 1;
+
+  // bounds for culling
+  mesh.aabbMin = boundsMin;
+  mesh.aabbMax = boundsMax;
+#if QUANTIZED_VERTICES
+  mesh.dequantize = MeshOptimizer::dequantize_matrix(boundsMin, boundsMax);
+#endif
+  return mesh;
+}
+
+static void add_mesh_lod(Mesh &mesh, const unsigned int *indices,
+                         std::size_t indexCount, float error)
+{
+  unsigned int firstIndex =
+      Core::GL::get_geometry_arena().add_indices(indices, indexCount);
+  mesh.lods[mesh.lodCount++] = {firstIndex,
+                                static_cast<unsigned int>(indexCount), error};
+}
+
+static_assert(Mesh::MAX_LODS == ModelCache::MAX_LODS);
+
+// simplify lod 0 into a chain of coarser index buffers, each about half the
+// triangles of the one before, and append them to the cache and the mesh.
+// The chain ends early once simplification stops paying off
+static void generate_mesh_lods(ModelCache::MeshRecord &record,
+                               ModelCache::Writer &writer, Mesh &mesh,
+                               const std::vector<Vertex> &vertices)
+{
+  // no level may move the surface by more than this part of the mesh size
+  constexpr float maxRelativeError = 0.1f;
+  const float maxError =
+      glm::length(mesh.aabbMax - mesh.aabbMin) * 0.5f * maxRelativeError;
+
+  const auto *lod0 = reinterpret_cast<const unsigned int *>(
+      writer.at(record.lods[0].indexOffset));
+  std::vector<unsigned int> source(lod0, lod0 + record.lods[0].indexCount);
+  std::vector<unsigned int> simplified(source.size());
+  std::vector<unsigned int> optimized(source.size());
+  float error = 0.0f;
+
+  for (int lod = 1; lod < ModelCache::MAX_LODS; ++lod)
+  {
+    float levelError = 0.0f;
+    std::size_t indexCount = MeshOptimizer::simplify(
+        simplified.data(), source.data(), source.size(), vertices.data(),
+        vertices.size(), source.size() / 6 * 3, maxError, &levelError);
+    if (indexCount == 0 || indexCount > source.size() * 3 / 4)
+      break;
+    // simplification scatters the order, restore cache locality
+    MeshOptimizer::optimize_vertex_cache(optimized.data(), simplified.data(),
+                                         indexCount, record.vertexCount);
+    simplified.swap(optimized);
+
+    // each level is simplified from the previous one, errors add up
+    error += levelError;
+    ModelCache::LodRecord &lodRecord = record.lods[lod];
+    lodRecord.indexCount = indexCount;
+    lodRecord.error = error;
+    lodRecord.indexOffset =
+        writer.append(simplified.data(), indexCount * sizeof(unsigned int));
+    record.lodCount = lod + 1;
+    add_mesh_lod(mesh, simplified.data(), indexCount, error);
+
+    source.assign(simplified.begin(), simplified.begin() + indexCount);
+  }
+}
+
+// hash of everything a cooked model is built from: the gltf/glb file and any
+// external buffers and images it references
+static std::uint64_t hash_gltf_sources(const cgltf_data *data,
+                                       const std::filesystem::path &path)
+{
+  auto hash_file = [](const std::filesystem::path &file, std::uint64_t seed)
+  {
+    MappedFile mapped;
+    if (!mapped.open(file))
+      return hash_string(file.string(), seed); // missing is still a state
+    return hash_bytes(mapped.data(), mapped.size(), seed);
+  };
+  auto is_external = [](const char *uri)
+  { return uri && std::strncmp(uri, "data:", 5) != 0; };
+
+  std::uint64_t hash = hash_file(path, FNV_OFFSET_BASIS);
+  for (size_t i = 0; i < data->buffers_count; ++i)
+  {
+    if (is_external(data->buffers[i].uri))
+      hash = hash_file(path.parent_path() / data->buffers[i].uri, hash);
+  }
+  for (size_t i = 0; i < data->images_count; ++i)
+  {
+    const cgltf_image &image = data->images[i];
+    if (!image.buffer_view && is_external(image.uri))
+      hash = hash_file(path.parent_path() / image.uri, hash);
+  }
+  return hash;
+}
+
+// files cgltf reads, the gltf/glb itself and external .bin buffers, mapped
+// instead of copied to the heap. cgltf only reads them, so the json, the glb
+// binary chunk and the buffers point straight into the mappings. Released by
+// cgltf_free, on whichever thread drops the model data last
+struct GltfMappings
+{
+  std::mutex mutex;
+  std::unordered_map<const void *, std::unique_ptr<MappedFile>> files;
+};
+
+static cgltf_result read_mapped_gltf_file(const cgltf_memory_options *,
+                                          const cgltf_file_options *options,
+                                          const char *path, cgltf_size *size,
+                                          void **data)
+{
+  auto file = std::make_unique<MappedFile>();
+  if (!file->open(path))
+    return cgltf_result_file_not_found;
+  // like cgltf's own reader: 0 asks for the whole file, buffers ask for their
+  // byteLength and a shorter file is an error, not reads past the mapping
+  if (*size == 0)
+    *size = file->size();
+  else if (file->size() < *size)
+    return cgltf_result_data_too_short;
+  *data = const_cast<unsigned char *>(file->data());
+
+  auto *mappings = static_cast<GltfMappings *>(options->user_data);
+  std::lock_guard lock(mappings->mutex);
+  mappings->files.emplace(*data, std::move(file));
+  return cgltf_result_success;
+}
+
+static void release_mapped_gltf_file(const cgltf_memory_options *,
+                                     const cgltf_file_options *options,
+                                     void *data)
+{
+  auto *mappings = static_cast<GltfMappings *>(options->user_data);
+  std::lock_guard lock(mappings->mutex);
+  mappings->files.erase(data);
+}
+
+// a model cache being written while its textures are still decoding.
+// load_gltf fills in the meshes, workers the textures. Whoever finishes last
+// writes the file
+struct PendingCook
+{
+  std::mutex mutex;
+  ModelCache::Writer writer;
+  std::filesystem::path path;
+  std::uint64_t sourceHash = 0;
+  // by texture table index, as referenced by the mesh records
+  std::vector<std::shared_ptr<const DecodedTexture>> textures;
+  std::size_t remaining = 0; // unfinished textures, plus one for the meshes
+  std::chrono::steady_clock::time_point start;
+  double decodeMs = 0;
+};
+
+// count one part of the cook as done, the last one writes the cache. Any
+// thread
+static void finish_cook_part(PendingCook &cook)
 {
+  {
+    std::lock_guard lock(cook.mutex);
+    if (--cook.remaining != 0)
+      return;
+  }
 
-  // Load positions
-  for (size_t j = 0; j < primitive->attributes_count; ++j)
+  std::size_t texMemUsage = 0;          // bytes
+  std::size_t uncompressedTexBytes = 0; // what texMemUsage would be raw
+  for (const auto &texture : cook.textures)
   {
-    auto *attribute = &primitive->attributes[j];
-    if (attribute->type == cgltf_attribute_type_position)
+    ModelCache::TextureRecord record{};
+    record.isLinear = texture->isLinear;
+    std::vector<unsigned char> chain; // levels packed back to back
+    if (texture->levels.empty())
     {
-      cgltf_accessor *accessor = attribute->data;
-      for (size_t k = 0; k < accessor->count; ++k) // each element
-      {
-        glm::vec3 position;
-        cgltf_accessor_read_float(accessor, k, &position.x,
-                                  3); // each component in element
-        vertices.emplace_back(position, glm::vec3{}, glm::vec2{});
-        // we load all positions and put placeholders for next loops
-      }
+      // failed to decode, meshes already point here. Store the placeholder
+      // the live model shows too
+      record.width = record.height = 1;
+      record.numChannels = 4;
+      chain = {128, 128, 128, 255};
     }
+    else
+    {
+      record.width = texture->levels.front().width;
+      record.height = texture->levels.front().height;
+      record.numChannels = texture->numChannels;
+      record.format = texture->format;
+      for (const DecodedTexture::Level &level : texture->levels)
+        chain.insert(chain.end(), level.data.begin(), level.data.end());
+      texMemUsage += chain.size();
+      uncompressedTexBytes += texture->uncompressedBytes;
+    }
+    record.levelCount =
+        std::max<std::int32_t>(1, static_cast<std::int32_t>(
+                                      texture->levels.size()));
+    record.dataOffset = cook.writer.append(chain.data(), chain.size());
+    record.dataSize = chain.size();
+    cook.writer.add_texture(record);
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - cook.start)
+                      .count();
+  printf("Textures: %.1f ms wall, %.1f ms decode and compress on %d "
+         "threads\n",
+         wallMs, cook.decodeMs, static_cast<int>(ThreadPool::shared().size()));
+  std::cout << "Loaded " << cook.textures.size() << " images. ";
+  std::cout << "GPU Memory usage: " << texMemUsage / 1'000'000 << " mb ("
+            << uncompressedTexBytes / 1'000'000 << " mb uncompressed)\n";
+
+  if (cook.writer.write(cook.path, cook.sourceHash, sizeof(GPUVertex)))
+    std::cout << "Wrote model cache: " << cook.path << "\n";
+}
+
+namespace Core::GL
+{
+
+GeometryArena &get_geometry_arena()
+{
+  static GeometryArena arena;
+  static bool created = false;
+  if (!created)
+  {
+    arena.create();
+    created = true;
   }
+  return arena;
+}
+
+// bytes of texture data uploaded per frame, at 60 fps about 250 mb/s
+constexpr std::size_t TEXTURE_STREAMING_BUDGET = 4 << 20;
 
-  // Load normals
-  for (size_t j = 0; j < primitive->attributes_count; ++j)
+TextureStreamer &get_texture_streamer()
+{
+  static TextureStreamer streamer;
+  static bool created = false;
+  if (!created)
   {
-    auto *attribute = &primitive->attributes[j];
-    if (attribute->type == cgltf_attribute_type_normal)
+    streamer.create(TEXTURE_STREAMING_BUDGET);
+    created = true;
+  }
+  return streamer;
+}
+
+MaterialLibrary &get_material_library()
+{
+  static MaterialLibrary library;
+  static bool created = false;
+  if (!created)
+  {
+    library.create();
+    created = true;
+  }
+  return library;
+}
+
+void update() // called by core begin drawing
+{
+  get_texture_streamer().update();
+  // after the streamer, so levels it finished reach the materials this frame
+  get_material_library().update();
+}
+
+// build a model straight from a mapped cooked cache. No parsing, decoding or
+// vertex conversion, only copies into GL objects. Textures stream in from
+// the mapping, which they keep open until done
+static Model load_cooked_model(std::shared_ptr<const ModelCache::Reader> cache)
+{
+  Model model{};
+
+  std::size_t vertexTotal = 0, indexTotal = 0;
+  for (const ModelCache::MeshRecord &record : cache->meshes())
+  {
+    vertexTotal += record.vertexCount;
+    for (std::uint32_t lod = 0; lod < record.lodCount; ++lod)
+      indexTotal += record.lods[lod].indexCount;
+  }
+  get_geometry_arena().reserve(vertexTotal, indexTotal);
+
+  using TextureCompress::Format;
+  MaterialLibrary &library = get_material_library();
+  std::vector<std::uint32_t> textureSlots;
+  for (const ModelCache::TextureRecord &texture : cache->textures())
+  {
+    textureSlots.push_back(MaterialLibrary::NO_TEXTURE);
+    // cooked on a machine with s3tc, can't upload here
+    if ((texture.format == Format::BC1 || texture.format == Format::BC3) &&
+        !has_s3tc())
     {
-      cgltf_accessor *accessor = attribute->data;
-      for (size_t k = 0; k < accessor->count; ++k)
-      {
-        glm::vec3 normal;
-        cgltf_accessor_read_float(accessor, k, &normal.x, 3);
-        vertices[k].normal = normal;
-      }
+      std::cerr << "Cached texture needs s3tc support, left untextured\n";
+      continue;
+    }
+    // images that failed to decode are cooked as 1x1 placeholders, shown
+    // untextured like the live model
+    if (texture.width == 1 && texture.height == 1)
+      continue;
+    TextureData data{};
+    data.width = texture.width;
+    data.height = texture.height;
+    data.numChannels = texture.numChannels;
+    data.isLinear = texture.isLinear;
+    data.format = texture.format;
+    std::uint64_t offset = texture.dataOffset;
+    for (int level = 0; level < texture.levelCount; ++level)
+    {
+      data.levels.push_back(cache->at(offset));
+      offset += ModelCache::mip_level_size(texture, level);
     }
+    data.owner = cache;
+
+    textureSlots.back() = library.create_texture();
+    library.submit(textureSlots.back(), std::move(data));
   }
 
-  // Load texcoords
-  for (size_t j = 0; j < primitive->attributes_count; ++j)
+  std::vector<std::uint32_t> materialIDs;
+  for (const ModelCache::MaterialRecord &material : cache->materials())
   {
-    auto *attribute = &primitive->attributes[j];
-    if (attribute->type == cgltf_attribute_type_texcoord)
+    materialIDs.push_back(library.create_material(
+        glm::make_vec4(material.baseColor),
+        material.diffuseTexture >= 0 ? textureSlots[material.diffuseTexture]
+                                     : MaterialLibrary::NO_TEXTURE));
+  }
+
+  for (const ModelCache::NodeRecord &node : cache->nodes())
+    model.scene.add_node(node.parent, glm::make_mat4(node.localMatrix));
+  model.scene.update();
+
+  // records of instanced meshes repeat the same blobs, upload those once
+  std::unordered_map<std::uint64_t, Mesh> uploaded; // by vertex offset
+  for (const ModelCache::MeshRecord &record : cache->meshes())
+  {
+    auto [it, added] = uploaded.try_emplace(record.vertexOffset);
+    Mesh &geometry = it->second;
+    if (added)
     {
-      cgltf_accessor *accessor = attribute->data;
-      for (size_t k = 0; k < accessor->count; ++k)
+      geometry = create_mesh(
+          reinterpret_cast<const GPUVertex *>(cache->at(record.vertexOffset)),
+          record.vertexCount,
+          reinterpret_cast<const unsigned int *>(
+              cache->at(record.lods[0].indexOffset)),
+          record.lods[0].indexCount, glm::make_vec3(record.boundsMin),
+          glm::make_vec3(record.boundsMax));
+      for (std::uint32_t lod = 1; lod < record.lodCount; ++lod)
       {
-        glm::vec2 texCoords;
-        cgltf_accessor_read_float(accessor, k, &texCoords.x, 2);
-        vertices[k].texcoord = texCoords;
+        const ModelCache::LodRecord &lodRecord = record.lods[lod];
+        add_mesh_lod(geometry,
+                     reinterpret_cast<const unsigned int *>(
+                         cache->at(lodRecord.indexOffset)),
+                     lodRecord.indexCount, lodRecord.error);
       }
     }
+    Mesh mesh = geometry;
+    mesh.node = record.node;
+    mesh.material = materialIDs[record.material];
+    model.meshes.push_back(mesh);
   }
 
-  // Load indices
-  for (size_t j = 0; j < primitive->indices->count; ++j)
-  {
-    unsigned int index;
-    cgltf_accessor_read_uint(primitive->indices, j, &index, 1);
-    indices.push_back(index);
-  }
+  std::cout << "Loaded cooked model: " << model.meshes.size() << " meshes, "
+            << materialIDs.size() << " materials, " << textureSlots.size()
+            << " textures\n";
+  return model;
 }
 
-namespace Core::GL
-{
-
-unsigned int debugDiffuse, debugSpecular;
-
 void init() // called by core init window
 {
-  debugDiffuse = load_texture(ASSETS_PATH "debug_diffuse.jpg", true);
-  debugSpecular = load_texture(ASSETS_PATH "debug_specular.jpg", false);
+  get_texture_streamer();
+  get_material_library();
 }
 // note: blender will auto trianglulate gltf exports
 Model load_gltf(const char *path)
 {
+  auto mappings = std::make_shared<GltfMappings>();
   cgltf_options options{};
+  options.file.read = read_mapped_gltf_file;
+  options.file.release = release_mapped_gltf_file;
+  options.file.user_data = mappings.get();
   cgltf_data *data = nullptr;
   cgltf_result result = cgltf_parse_file(&options, path, &data);
 
   if (result != cgltf_result_success)
   {
     std::cerr << "Failed to parse glTF file." << std::endl;
+    return {};
+  }
+  // texture workers outlive this call and read the buffers, last one frees.
+  // The mappings must outlive cgltf_free, which unmaps through them
+  std::shared_ptr<cgltf_data> source(data, [mappings](cgltf_data *parsed)
+                                     { cgltf_free(parsed); });
+
+  // parsing only reads the json chunk, which is enough to find every source
+  // file. On a cache hit nothing else is loaded
+  const std::filesystem::path cachePath = ModelCache::get_cache_path(path);
+  const std::uint64_t sourceHash = hash_gltf_sources(data, path);
+  {
+    auto cache = std::make_shared<ModelCache::Reader>();
+    if (cache->open(cachePath, sourceHash, sizeof(GPUVertex)))
+    {
+      std::cout << "Model cache hit: " << cachePath << "\n";
+      return load_cooked_model(std::move(cache));
+    }
   }
+  auto cook = std::make_shared<PendingCook>();
+  cook->path = cachePath;
+  cook->sourceHash = sourceHash;
+  ModelCache::Writer &cacheWriter = cook->writer; // meshes, this thread only
 
   result = cgltf_load_buffers(&options, data, path);
   if (result != cgltf_result_success)
   {
     std::cerr << "Failed to load buffers." << std::endl;
-    cgltf_free(data);
+    return {};
   }
   auto *file_type = data->file_type == cgltf_file_type_glb ? "glb" : "gltf";
   std::cout << file_type << " model loaded successfully from: " << path << "\n";
@@ -363,12 +1014,16 @@ Model load_gltf(const char *path)
       return model;
   }
 
-  std::unordered_map<std::string_view, unsigned int> loadedImages{};
-  int estTexMemUsage = 0; // bytes
+  // material library texture slot per image
+  std::unordered_map<const cgltf_image *, std::uint32_t> loadedImages{};
+  // cache texture table index per image
+  std::unordered_map<const cgltf_image *, std::int32_t> cookedImages{};
 
   std::filesystem::path modelPath(path);
 
-  // traverse materials and load only diffuse/specular for now
+  // traverse materials and collect unique images, only diffuse/specular for
+  // now. Different materials can use the same image
+  std::vector<std::pair<const cgltf_image *, bool>> uniqueImages{};
   for (size_t i = 0; i < data->materials_count; ++i)
   {
     const cgltf_material &material = data->materials[i];
@@ -377,137 +1032,280 @@ Model load_gltf(const char *path)
       continue;
     }
 
-    auto load = [&](cgltf_image *cgltf_image, bool isLinear)
+    auto collect = [&](const cgltf_image *cgltf_image, bool isLinear)
     {
-      if (loadedImages.contains(cgltf_image->name))
-      {
-        // avoid dup image load because different material can use same texture
-        return;
-      }
-      Image image = load_cgltf_image(cgltf_image, modelPath.parent_path());
-      estTexMemUsage += (image.width * image.height * image.numChannels) *
-                        1.33; // 1.33 for mipmapping
-      loadedImages[cgltf_image->name] = create_gltexture(image, isLinear);
-      free_image(image);
+      if (loadedImages.try_emplace(cgltf_image, 0).second)
+        uniqueImages.emplace_back(cgltf_image, isLinear);
     };
 
     if (material.pbr_metallic_roughness.base_color_texture.texture)
     {
       // diffuse
-      load(material.pbr_metallic_roughness.base_color_texture.texture->image,
-           false);
+      collect(material.pbr_metallic_roughness.base_color_texture.texture->image,
+              false);
     }
 
     // specular
     if (!material.has_specular || !material.specular.specular_texture.texture)
       continue;
 
-    // load(material.specular.specular_texture.texture->image);
+    // collect(material.specular.specular_texture.texture->image, true);
   }
-  std::cout << "Loaded " << loadedImages.size() << " images. ";
-  std::cout << "Est GPU Memory usage: " << estTexMemUsage / 1'000'000
-            << " mb\n";
 
-  for (size_t i = 0; i < data->nodes_count; ++i)
+  // every image gets a material texture slot now and streams into an array
+  // layer once a worker has decoded, resized and mipmapped it. Nothing here
+  // waits on the workers, the model renders right away
+  cook->textures.resize(uniqueImages.size());
+  cook->remaining = uniqueImages.size() + 1;
+  cook->start = std::chrono::steady_clock::now();
+  const bool s3tc = has_s3tc(); // ask GL here, workers can't
+  for (std::size_t index = 0; index < uniqueImages.size(); ++index)
   {
-    cgltf_node node = data->nodes[i];
+    auto [cgltf_image, isLinear] = uniqueImages[index];
+    const std::uint32_t slot = get_material_library().create_texture();
+    loadedImages[cgltf_image] = slot;
+    cookedImages[cgltf_image] = static_cast<std::int32_t>(index);
+
+    ThreadPool::shared().submit(
+        [cook, source, modelPath, cgltf_image, isLinear, s3tc, slot, index]
+        {
+          auto start = std::chrono::steady_clock::now();
+          auto texture = std::make_shared<DecodedTexture>();
+          texture->source = cgltf_image;
+          texture->isLinear = isLinear;
+
+          Image image = load_cgltf_image(cgltf_image, modelPath.parent_path());
+          if (image.data)
+          {
+            texture->numChannels = image.numChannels;
+            std::size_t size =
+                std::size_t(image.width) * image.height * image.numChannels;
+            texture->levels.push_back(
+                {image.width, image.height,
+                 std::vector<unsigned char>(image.data, image.data + size)});
+            expand_channels(*texture);
+            limit_texture_size(*texture, MaterialLibrary::MAX_LAYER_SIZE);
+            generate_mips(*texture);
+            for (const DecodedTexture::Level &level : texture->levels)
+              texture->uncompressedBytes += level.data.size();
+            compress_texture(*texture, s3tc);
+          }
+          free_image(image);
+
+          texture->decodeMs = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+          if (!texture->levels.empty()) // else reported by decoder
+          {
+            printf("Loaded image %s: width %d, height %d, %d mips (%.1f ms)\n",
+                   cgltf_image->name ? cgltf_image->name : "(unnamed)",
+                   image.width, image.height,
+                   static_cast<int>(texture->levels.size()),
+                   texture->decodeMs);
+            submit_material_texture(slot, texture);
+          }
+
+          {
+            std::lock_guard lock(cook->mutex);
+            cook->textures[index] = texture;
+            cook->decodeMs += texture->decodeMs;
+          }
+          finish_cook_part(*cook);
+        });
+  }
 
-    if (node.children_count != 0)
+  // reserve every mesh blob and the arena up front so extraction and uploads
+  // never reallocate
+  {
+    std::size_t vertexTotal = 0, indexTotal = 0;
+    std::size_t blobBytes = 0;
+    for (size_t i = 0; i < data->nodes_count; ++i)
     {
-      std::cout << "node has children. This is not supported yet\n";
-      continue;
+      const cgltf_mesh *mesh = data->nodes[i].mesh;
+      for (size_t j = 0; mesh && j < mesh->primitives_count; ++j)
+      {
+        const cgltf_primitive &primitive = mesh->primitives[j];
+        const cgltf_accessor *positions =
+            find_attribute(primitive, cgltf_attribute_type_position);
+        if (!positions)
+          continue; // skipped, see check_mesh
+        std::size_t vertexCount = positions->count;
+        vertexTotal += vertexCount;
+        indexTotal += primitive.indices->count;
+        // lods add up to less than another full index buffer
+        blobBytes += vertexCount * sizeof(GPUVertex) +
+                     2 * primitive.indices->count * sizeof(unsigned int) +
+                     16 * (1 + ModelCache::MAX_LODS);
+      }
     }
-    if (!node.mesh)
+    cacheWriter.reserve(blobBytes);
+    get_geometry_arena().reserve(vertexTotal, 2 * indexTotal);
+  }
+
+  // import the node hierarchy depth first from the scene roots, which puts
+  // parents before children the way SceneGraph wants. Files without a scene
+  // use every node without a parent
+  std::vector<std::pair<const cgltf_node *, std::uint32_t>> stack;
+  const cgltf_scene *scene =
+      data->scene ? data->scene : data->scenes_count ? data->scenes : nullptr;
+  if (scene)
+  {
+    for (size_t i = scene->nodes_count; i-- > 0;)
+      stack.emplace_back(scene->nodes[i], SceneGraph::NO_PARENT);
+  }
+  else
+  {
+    for (size_t i = data->nodes_count; i-- > 0;)
+      if (!data->nodes[i].parent)
+        stack.emplace_back(&data->nodes[i], SceneGraph::NO_PARENT);
+  }
+  model.scene.reserve(data->nodes_count);
+
+  // nodes that share a mesh share its geometry and cache blobs
+  std::unordered_map<const cgltf_primitive *,
+                     std::pair<Mesh, ModelCache::MeshRecord>>
+      loadedPrimitives;
+
+  // one library material per gltf material, made on first use. Primitives
+  // without one share a white default
+  struct LoadedMaterial
+  {
+    std::uint32_t id;     // in the material library
+    std::uint32_t record; // in the cache material table
+  };
+  std::unordered_map<const cgltf_material *, LoadedMaterial> loadedMaterials;
+  auto get_material = [&](const cgltf_material *material)
+  {
+    auto [it, added] = loadedMaterials.try_emplace(material);
+    if (!added)
+      return it->second;
+
+    ModelCache::MaterialRecord record{};
+    glm::vec4 baseColor(1.0f);
+    std::uint32_t diffuse = MaterialLibrary::NO_TEXTURE;
+    if (material && material->has_pbr_metallic_roughness)
     {
-      std::cout << "node is not mesh. Skipping for now\n";
-      continue;
+      const cgltf_pbr_metallic_roughness &pbr =
+          material->pbr_metallic_roughness;
+      baseColor = glm::make_vec4(pbr.base_color_factor);
+      if (pbr.base_color_texture.texture)
+      {
+        const cgltf_image *image = pbr.base_color_texture.texture->image;
+        diffuse = loadedImages.at(image);
+        record.diffuseTexture = cookedImages.at(image);
+      }
+      // specular textures are not collected yet
     }
-    if (node.mesh)
+    std::memcpy(record.baseColor, &baseColor.x, sizeof(float) * 4);
+    it->second = {get_material_library().create_material(baseColor, diffuse),
+                  cacheWriter.add_material(record)};
+    return it->second;
+  };
+
+  std::vector<Vertex> vertices; // per primitive scratch, keeps its capacity
+  while (!stack.empty())
+  {
+    auto [node, parent] = stack.back();
+    stack.pop_back();
+
+    const glm::mat4 localMatrix = get_node_matrix(*node);
+    const std::uint32_t nodeIndex = model.scene.add_node(parent, localMatrix);
+    ModelCache::NodeRecord nodeRecord{};
+    nodeRecord.parent = parent;
+    std::memcpy(nodeRecord.localMatrix, &localMatrix[0][0], sizeof(float) * 16);
+    cacheWriter.add_node(nodeRecord);
+
+    for (size_t i = node->children_count; i-- > 0;)
+      stack.emplace_back(node->children[i], nodeIndex);
+
+    if (node->mesh)
     {
-      for (size_t j = 0; j < node.mesh->primitives_count; ++j)
+      for (size_t j = 0; j < node->mesh->primitives_count; ++j)
       {
-        cgltf_primitive &primitive = node.mesh->primitives[j];
-
-        std::vector<Vertex> vertices{};
-        std::vector<unsigned int> indices{};
-        load_primitive_vertices_and_indices(&primitive, vertices, indices);
-
-        std::cout << "Indices: " << indices.size() << "\n";
-
-        GLuint vao;
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
-
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                     vertices.data(), GL_STATIC_DRAW);
-
-        GLuint ebo;
-        glGenBuffers(1, &ebo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                     indices.size() * sizeof(unsigned int), indices.data(),
-                     GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)0);
-
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, normal));
-
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, texcoord));
-
-        Mesh myMesh{};
-        myMesh.vao = vao;
-        myMesh.vbo = vbo;
-        myMesh.ebo = ebo;
-        myMesh.transform = get_node_transform(node);
-        myMesh.triangleCount = indices.size() / 3;
-        myMesh.indicesCount = indices.size();
-        std::cout << "Triangles: " << myMesh.triangleCount << "\n";
-
-        // texture loading
-        // always give mesh debug textures
-        myMesh.diffuseTextureID = debugDiffuse;
-        myMesh.specularTextureID = debugSpecular;
-
-        if (!primitive.material ||
-            !primitive.material->has_pbr_metallic_roughness)
+        cgltf_primitive &primitive = node->mesh->primitives[j];
+        const cgltf_accessor *positions =
+            find_attribute(primitive, cgltf_attribute_type_position);
+        if (!positions)
+          continue; // skipped, see check_mesh
+        if (auto it = loadedPrimitives.find(&primitive);
+            it != loadedPrimitives.end())
         {
-          // bad
+          auto [mesh, record] = it->second;
+          mesh.node = record.node = nodeIndex;
+          model.meshes.push_back(mesh);
+          cacheWriter.add_mesh(record);
+          continue;
         }
-        else
-        {
-          // diffuse
-          cgltf_texture *texture = primitive.material->pbr_metallic_roughness
-                                       .base_color_texture.texture;
-          if (texture)
-          {
-            myMesh.diffuseTextureID = loadedImages.at(texture->image->name);
-          }
-          // specular
-          if (primitive.material->has_specular &&
-              primitive.material->specular.specular_texture.texture)
-          {
 
-            // myMesh.specularTextureID =
-            //     loadedImages.at(primitive.material->specular.specular_texture
-            //                         .texture->image->name);
-          }
-        }
+        // indices are extracted straight into the cooked cache blob, which
+        // is also the upload source. Vertices go through the float scratch
+        // buffer the optimizers work on, then get stored in the arena layout
+        ModelCache::MeshRecord record{};
+        ModelCache::LodRecord &lod0 = record.lods[0];
+        lod0.indexCount = primitive.indices->count;
+        record.lodCount = 1;
+        lod0.indexOffset =
+            cacheWriter.allocate(lod0.indexCount * sizeof(unsigned int));
+
+        vertices.resize(positions->count);
+        auto *indices =
+            reinterpret_cast<unsigned int *>(cacheWriter.at(lod0.indexOffset));
+        load_primitive_vertices(primitive, vertices.data(), vertices.size());
+        load_primitive_indices(primitive, indices);
+
+        std::cout << "Indices: " << lod0.indexCount << "\n";
+
+        // optimizers index per vertex and per triangle arrays, out of range
+        // indices or a trailing partial triangle would crash them. Upload
+        // such meshes as they are
+        const bool validIndices =
+            lod0.indexCount % 3 == 0 &&
+            std::all_of(indices, indices + lod0.indexCount,
+                        [&](unsigned int index)
+                        { return index < vertices.size(); });
+        if (validIndices)
+          optimize_mesh(vertices, indices, lod0.indexCount);
+        else
+          std::cout << "Warning: invalid indices, mesh not optimized\n";
+
+        glm::vec3 boundsMin, boundsMax;
+        compute_bounds(vertices, boundsMin, boundsMax);
+        std::memcpy(record.boundsMin, &boundsMin.x, sizeof(float) * 3);
+        std::memcpy(record.boundsMax, &boundsMax.x, sizeof(float) * 3);
+        record.vertexCount = vertices.size();
+        record.vertexOffset =
+            store_vertices(cacheWriter, vertices, boundsMin, boundsMax);
+
+        // the store may have moved the blobs
+        Mesh myMesh = create_mesh(
+            reinterpret_cast<const GPUVertex *>(
+                cacheWriter.at(record.vertexOffset)),
+            record.vertexCount,
+            reinterpret_cast<const unsigned int *>(
+                cacheWriter.at(lod0.indexOffset)),
+            lod0.indexCount, boundsMin, boundsMax);
+        if (validIndices)
+          generate_mesh_lods(record, cacheWriter, myMesh, vertices);
+        myMesh.node = record.node = nodeIndex;
+        std::cout << "Triangles: " << myMesh.triangleCount;
+        for (int lod = 1; lod < myMesh.lodCount; ++lod)
+          std::cout << " -> " << myMesh.lods[lod].indicesCount / 3;
+        std::cout << "\n";
+
+        const LoadedMaterial material = get_material(primitive.material);
+        myMesh.material = material.id;
+        record.material = material.record;
 
         model.meshes.push_back(myMesh);
+        cacheWriter.add_mesh(record);
+        loadedPrimitives.emplace(&primitive, std::pair(myMesh, record));
       }
     }
   }
+  model.scene.update();
 
-  cgltf_free(data);
+  // the cache is written once the textures are done too
+  finish_cook_part(*cook);
   return model;
 }
 
@@ -519,62 +1317,6 @@ unsigned int load_texture(const char *path, bool isLinear)
   return textureID;
 }
 
-// TODO: this is incomplete. Also should be internal api
-void draw_mesh_instanced(std::vector<glm::mat4> matrixes, unsigned int IBO,
-                         const Mesh &srcMesh)
-{
-  glBindBuffer(GL_ARRAY_BUFFER, IBO);
-  glBufferData(GL_ARRAY_BUFFER, matrixes.size() * sizeof(glm::mat4),
-               matrixes.data(), GL_DYNAMIC_DRAW);
-
-  glBindVertexArray(srcMesh.vao);
-  glDrawElementsInstanced(GL_TRIANGLES, srcMesh.indicesCount, GL_UNSIGNED_INT,
-                          0, matrixes.size());
-}
-// internal api to instance a vao.
-unsigned int create_instance_buffer_object(unsigned int vao)
-{
-  unsigned int ibo;
-  glGenBuffers(1, &ibo);
-  glBindBuffer(GL_ARRAY_BUFFER, ibo);
-
-  glBindVertexArray(vao);
-  // set attribute pointers for matrix (4 times vec4)
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)0);
-  glEnableVertexAttribArray(4);
-  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
-                        (void *)(sizeof(glm::vec4)));
-  glEnableVertexAttribArray(5);
-  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
-                        (void *)(2 * sizeof(glm::vec4)));
-  glEnableVertexAttribArray(6);
-  glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
-                        (void *)(3 * sizeof(glm::vec4)));
-
-  glVertexAttribDivisor(3, 1);
-  glVertexAttribDivisor(4, 1);
-  glVertexAttribDivisor(5, 1);
-  glVertexAttribDivisor(6, 1);
-  return ibo;
-}
-// internal api to update ibo with matrix data
-void update_instance_buffer_object(unsigned int ibo,
-                                   const std::vector<Transform> &instances)
-{
-  const int instancesCount = instances.size();
-
-  std::vector<glm::mat4> matrixes(instancesCount);
-  for (int i = 0; i < instancesCount; ++i)
-  {
-    matrixes[i] = instances[i].get_matrix();
-  }
-
-  glBindBuffer(GL_ARRAY_BUFFER, ibo);
-  glBufferData(GL_ARRAY_BUFFER, instancesCount * sizeof(glm::mat4),
-               matrixes.data(), GL_DYNAMIC_DRAW);
-}
-
 void render_fullscreen_quad()
 {
   static unsigned int quadVAO, quadVBO = 0;
@@ -668,23 +1410,6 @@ void draw_cube()
   glBindVertexArray(cubeVAO);
   glDrawElements(GL_TRIANGLES, cubeIndicesCount, GL_UNSIGNED_INT, nullptr);
 }
-void draw_cube(const std::vector<Transform> &instances)
-{
-  create_cube_lazy();
-
-  static unsigned int ibo;
-  static bool created = false;
-  if (!created)
-  {
-    ibo = create_instance_buffer_object(cubeVAO);
-    created = true;
-  }
-  update_instance_buffer_object(ibo, instances);
-
-  glBindVertexArray(cubeVAO);
-  glDrawElementsInstanced(GL_TRIANGLES, cubeIndicesCount, GL_UNSIGNED_INT, 0,
-                          instances.size());
-}
 
 unsigned int sphereVAO;
 unsigned int sphereIndicesCount = 0;
@@ -762,24 +1487,22 @@ void draw_sphere()
   glBindVertexArray(sphereVAO);
   glDrawElements(GL_TRIANGLES, sphereIndicesCount, GL_UNSIGNED_INT, nullptr);
 }
-// TODO: measure performance of this
-void draw_sphere(const std::vector<Transform> &instances)
+void draw_cube_instanced(std::size_t instanceCount)
 {
-  create_sphere_lazy();
+  create_cube_lazy();
 
-  static unsigned int ibo;
-  static bool created = false;
-  if (!created)
-  {
-    ibo = create_instance_buffer_object(sphereVAO);
-    created = true;
-  }
-  update_instance_buffer_object(ibo, instances);
+  glBindVertexArray(cubeVAO);
+  glDrawElementsInstanced(GL_TRIANGLES, cubeIndicesCount, GL_UNSIGNED_INT,
+                          nullptr, instanceCount);
+}
+
+void draw_sphere_instanced(std::size_t instanceCount)
+{
+  create_sphere_lazy();
 
-  // draw
   glBindVertexArray(sphereVAO);
-  glDrawElementsInstanced(GL_TRIANGLES, sphereIndicesCount, GL_UNSIGNED_INT, 0,
-                          instances.size());
+  glDrawElementsInstanced(GL_TRIANGLES, sphereIndicesCount, GL_UNSIGNED_INT,
+                          nullptr, instanceCount);
 }
 
 } // namespace Core::GL
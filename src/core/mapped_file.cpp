@@ -0,0 +1,105 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::filesystem::path &path)
+{
+  close();
+
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size{};
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  fileHandle = file;
+  mappingHandle = mapping;
+  mappedData = static_cast<const unsigned char *>(view);
+  mappedSize = static_cast<std::size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (mappedData)
+    UnmapViewOfFile(mappedData);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  mappedData = nullptr;
+  mappedSize = 0;
+  mappingHandle = nullptr;
+  fileHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::filesystem::path &path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat info{};
+  if (fstat(fd, &info) == -1 || info.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void *view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping keeps its own reference to the file
+  if (view == MAP_FAILED)
+    return false;
+
+  mappedData = static_cast<const unsigned char *>(view);
+  mappedSize = static_cast<std::size_t>(info.st_size);
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (mappedData)
+    munmap(const_cast<unsigned char *>(mappedData), mappedSize);
+  mappedData = nullptr;
+  mappedSize = 0;
+}
+
+#endif
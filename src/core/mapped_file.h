@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// read only memory mapping of a whole file. Pages are faulted in on access,
+// so reading only part of a big file only touches that part
+class MappedFile
+{
+private:
+  const unsigned char *mappedData = nullptr;
+  std::size_t mappedSize = 0;
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // false if the file can't be opened or is empty
+  bool open(const std::filesystem::path &path);
+  void close();
+
+  bool is_open() const { return mappedData != nullptr; }
+  const unsigned char *data() const { return mappedData; }
+  std::size_t size() const { return mappedSize; }
+};
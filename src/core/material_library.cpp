@@ -0,0 +1,230 @@
+#include "material_library.h"
+#include "core/core.h"
+#include "core/uniform_buffer.h"
+
+#include <algorithm>
+#include <bit>
+#include <gldoc.hpp>
+#include <iostream>
+#include <utility>
+
+// sized internal format, immutable storage needs one
+static int get_storage_format(TextureCompress::Format format, int numChannels,
+                              bool isLinear)
+{
+  if (format != TextureCompress::Format::NONE)
+    return get_compressed_format(format, isLinear);
+  switch (numChannels)
+  {
+  case 1:
+    return GL_R8;
+  case 2:
+    return GL_RG8;
+  case 3:
+    return isLinear ? GL_RGB8 : GL_SRGB8;
+  default:
+    return isLinear ? GL_RGBA8 : GL_SRGB8_ALPHA8;
+  }
+}
+
+// levels of a full mip chain, halving with max(1, size / 2) down to 1x1
+static int full_level_count(int width, int height)
+{
+  return std::bit_width(static_cast<unsigned int>(std::max(width, height)));
+}
+
+void MaterialLibrary::create() { glGenBuffers(1, &ssbo); }
+
+void MaterialLibrary::destroy()
+{
+  for (int i = 0; i < arrayCount; ++i)
+    glDeleteTextures(1, &arrays[i].texture);
+  glDeleteBuffers(1, &ssbo);
+  arrayCount = 0;
+  textures.clear();
+  materials.clear();
+  ssbo = 0;
+  ssboCapacity = 0;
+}
+
+std::uint32_t MaterialLibrary::create_texture()
+{
+  textures.emplace_back();
+  return static_cast<std::uint32_t>(textures.size() - 1);
+}
+
+std::uint32_t MaterialLibrary::create_material(const glm::vec4 &baseColor,
+                                               std::uint32_t diffuseTexture)
+{
+  const auto index = static_cast<std::uint32_t>(materials.size());
+  materials.push_back({baseColor, -1, 0, 0, 0, glm::vec2(0.0f),
+                       glm::vec2(0.0f)});
+  if (diffuseTexture != NO_TEXTURE)
+  {
+    Texture &texture = textures[diffuseTexture];
+    texture.materials.push_back(index);
+    update_materials(texture);
+  }
+  dirty = true;
+  return index;
+}
+
+void MaterialLibrary::submit(std::uint32_t texture, TextureData data)
+{
+  std::lock_guard lock(mutex);
+  incoming.push_back({texture, std::move(data)});
+}
+
+int MaterialLibrary::find_array(const TextureData &data)
+{
+  for (int i = 0; i < arrayCount; ++i)
+  {
+    const TextureArray &array = arrays[i];
+    if (array.format == data.format && array.isLinear == data.isLinear &&
+        (data.format != TextureCompress::Format::NONE ||
+         array.numChannels == data.numChannels) &&
+        array.width == data.width && array.height == data.height)
+      return i;
+  }
+  if (arrayCount == MAX_ARRAYS)
+    return -1;
+
+  TextureArray &array = arrays[arrayCount];
+  array = {};
+  array.format = data.format;
+  array.numChannels = data.numChannels;
+  array.isLinear = data.isLinear;
+  array.width = data.width;
+  array.height = data.height;
+  array.levels = full_level_count(data.width, data.height);
+  return arrayCount++;
+}
+
+// double the layers. Immutable storage can't grow, so copy into a new array
+// and point pending uploads at it
+void MaterialLibrary::grow_array(TextureArray &array)
+{
+  const int capacity = std::max(4, array.layerCapacity * 2);
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels,
+                 get_storage_format(array.format, array.numChannels,
+                                    array.isLinear),
+                 array.width, array.height, capacity);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  if (array.texture)
+  {
+    if (array.layerCount > 0)
+    {
+      for (int level = 0; level < array.levels; ++level)
+      {
+        const int width = std::max(1, array.width >> level);
+        const int height = std::max(1, array.height >> level);
+        glCopyImageSubData(array.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                           texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width,
+                           height, array.layerCount);
+      }
+    }
+    Core::GL::get_texture_streamer().retarget(array.texture, texture);
+    glDeleteTextures(1, &array.texture);
+  }
+  array.texture = texture;
+  array.layerCapacity = capacity;
+}
+
+void MaterialLibrary::update_materials(const Texture &texture)
+{
+  for (std::uint32_t index : texture.materials)
+  {
+    GPUMaterial &material = materials[index];
+    material.diffuseArray = texture.array;
+    material.diffuseLayer = texture.layer;
+    material.diffuseLevel = texture.level;
+    if (texture.array >= 0)
+    {
+      const TextureArray &array = arrays[texture.array];
+      material.diffuseLevels = array.levels;
+      material.diffuseSize = glm::vec2(array.width, array.height);
+    }
+  }
+  dirty = true;
+}
+
+void MaterialLibrary::update()
+{
+  std::vector<Incoming> arrived;
+  {
+    std::lock_guard lock(mutex);
+    arrived.swap(incoming);
+  }
+
+  for (Incoming &item : arrived)
+  {
+    TextureData &data = item.data;
+    if (data.width < 1 || data.height < 1 ||
+        static_cast<int>(data.levels.size()) !=
+            full_level_count(data.width, data.height))
+    {
+      std::cerr << "Material texture " << data.width << "x" << data.height
+                << " doesn't have all mips, skipped\n";
+      continue;
+    }
+    const int arrayIndex = find_array(data);
+    if (arrayIndex < 0)
+    {
+      std::cerr << "Material texture needs a new format or size, but all "
+                << MAX_ARRAYS << " arrays are used. Skipped\n";
+      continue;
+    }
+    TextureArray &array = arrays[arrayIndex];
+    if (array.layerCount == array.layerCapacity)
+      grow_array(array);
+
+    Texture &texture = textures[item.texture];
+    texture.array = arrayIndex;
+    texture.layer = array.layerCount++;
+    texture.level = array.levels; // nothing resident yet
+    update_materials(texture);
+
+    // levels complete during later streamer updates, on this thread
+    data.layer = texture.layer;
+    data.onLevelReady = [this, slot = item.texture](int level)
+    {
+      Texture &streamed = textures[slot];
+      streamed.level = level;
+      update_materials(streamed);
+    };
+    Core::GL::get_texture_streamer().submit(array.texture, std::move(data));
+  }
+
+  if (!dirty)
+    return;
+  dirty = false;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+  if (ssboCapacity < materials.size())
+  {
+    ssboCapacity = std::max<std::size_t>(64, materials.size() * 2);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ssboCapacity * sizeof(GPUMaterial),
+                 nullptr, GL_DYNAMIC_DRAW);
+  }
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                  materials.size() * sizeof(GPUMaterial), materials.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MaterialLibrary::bind() const
+{
+  for (int i = 0; i < MAX_ARRAYS; ++i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, i < arrayCount ? arrays[i].texture : 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::MATERIALS, ssbo);
+}
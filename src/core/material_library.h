@@ -0,0 +1,108 @@
+#pragma once
+
+#include "core/texture_compress.h"
+#include "core/texture_streamer.h"
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// materials of every loaded model and the textures they sample. Textures
+// are layers of GL_TEXTURE_2D_ARRAYs, one per format and size, each with
+// the full mip chain of its size. Materials live in one storage buffer and
+// carry the array, size and levels of their texture, so draws pick theirs by
+// index, the geometry pass binds everything once and never switches
+// textures between draws
+class MaterialLibrary
+{
+public:
+  // larger textures are halved down to this at import
+  static constexpr int MAX_LAYER_SIZE = 4096;
+  // arrays bound at once, units 0 to MAX_ARRAYS - 1. The geometry shader
+  // selects one with a switch of the same size. 16 is the smallest
+  // GL_MAX_TEXTURE_IMAGE_UNITS GL allows
+  static constexpr int MAX_ARRAYS = 16;
+  static constexpr std::uint32_t NO_TEXTURE = ~0u;
+
+  // std430 Material in include/materials.glsl
+  struct alignas(16) GPUMaterial
+  {
+    glm::vec4 baseColor;
+    std::int32_t diffuseArray; // -1 untextured
+    std::int32_t diffuseLayer;
+    // finest mip streamed in so far, diffuseLevels while there is none
+    std::int32_t diffuseLevel;
+    std::int32_t diffuseLevels; // of the array
+    glm::vec2 diffuseSize;      // texels of level 0
+    glm::vec2 padding;
+  };
+
+private:
+  // layers of one format and size
+  struct TextureArray
+  {
+    unsigned int texture = 0;
+    TextureCompress::Format format;
+    int numChannels;
+    bool isLinear;
+    int width, height;
+    int levels; // full chain down to 1x1
+    int layerCount = 0, layerCapacity = 0;
+  };
+
+  struct Texture
+  {
+    int array = -1, layer = -1; // none until its data arrives
+    int level = 0;              // finest resident, levels while none
+    std::vector<std::uint32_t> materials; // using it
+  };
+
+  struct Incoming
+  {
+    std::uint32_t texture;
+    TextureData data;
+  };
+
+  TextureArray arrays[MAX_ARRAYS];
+  int arrayCount = 0;
+  std::vector<Texture> textures;
+  std::vector<GPUMaterial> materials;
+  unsigned int ssbo = 0;
+  std::size_t ssboCapacity = 0; // materials
+  bool dirty = false;
+
+  std::mutex mutex; // guards incoming
+  std::vector<Incoming> incoming;
+
+  int find_array(const TextureData &data);
+  void grow_array(TextureArray &array);
+  void update_materials(const Texture &texture);
+
+public:
+  void create();
+  void destroy();
+
+  // slot for a texture whose data comes later through submit. GL thread
+  std::uint32_t create_texture();
+  // returns the material index. GL thread
+  std::uint32_t create_material(const glm::vec4 &baseColor,
+                                std::uint32_t diffuseTexture = NO_TEXTURE);
+
+  // queue the mip chain of a texture slot, every level down to 1x1. Any
+  // thread
+  void submit(std::uint32_t texture, TextureData data);
+
+  // give queued textures array layers and start streaming them, upload
+  // changed materials. GL thread, once per frame after the streamer update
+  void update();
+
+  // arrays to units 0 to MAX_ARRAYS - 1, materials to
+  // StorageBinding::MATERIALS
+  void bind() const;
+
+  std::size_t get_material_count() const { return materials.size(); }
+};
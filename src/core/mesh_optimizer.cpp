@@ -0,0 +1,629 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/common.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/geometric.hpp>
+#include <numeric>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+// sum of squared distances to a set of planes, area weighted. Symmetric 4x4
+// stored as its upper triangle
+struct Quadric
+{
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+  double weight;
+
+  void add(const Quadric &q)
+  {
+    a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2;
+    bc += q.bc, bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2;
+    weight += q.weight;
+  }
+
+  // mean squared distance of p to the planes
+  double error(const glm::vec3 &p) const
+  {
+    if (weight <= 0.0)
+      return 0.0;
+    double x = p.x, y = p.y, z = p.z;
+    double r = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+               2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+               2.0 * (ad * x + bd * y + cd * z);
+    return std::abs(r) / weight;
+  }
+};
+
+Quadric plane_quadric(const glm::vec3 &p0, const glm::vec3 &p1,
+                      const glm::vec3 &p2)
+{
+  glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+  float length = glm::length(normal);
+  if (length <= 0.0f)
+    return {};
+
+  double area = length * 0.5;
+  double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+  double d = -(a * p0.x + b * p0.y + c * p0.z);
+  return {area * a * a, area * a * b, area * a * c, area * a * d,
+          area * b * b, area * b * c, area * b * d, area * c * c,
+          area * c * d, area * d * d, area};
+}
+
+struct Collapse
+{
+  unsigned int from, to;
+  double cost;
+};
+
+// canonical vertex per position, seams are several vertices with one
+// position and different normals/uvs
+std::vector<unsigned int> weld_positions(const Vertex *vertices,
+                                         std::size_t vertexCount)
+{
+  std::vector<unsigned int> order(vertexCount);
+  std::iota(order.begin(), order.end(), 0u);
+  auto less = [&](unsigned int a, unsigned int b)
+  {
+    const glm::vec3 &pa = vertices[a].position, &pb = vertices[b].position;
+    if (pa.x != pb.x)
+      return pa.x < pb.x;
+    if (pa.y != pb.y)
+      return pa.y < pb.y;
+    return pa.z < pb.z;
+  };
+  std::sort(order.begin(), order.end(), less);
+
+  std::vector<unsigned int> canonical(vertexCount);
+  for (std::size_t i = 0; i < vertexCount; ++i)
+  {
+    bool same = i > 0 && vertices[order[i]].position ==
+                             vertices[order[i - 1]].position;
+    canonical[order[i]] = same ? canonical[order[i - 1]] : order[i];
+  }
+  return canonical;
+}
+
+// vertex to triangle adjacency in compressed rows
+struct Adjacency
+{
+  std::vector<unsigned int> offsets; // vertexCount + 1
+  std::vector<unsigned int> triangles;
+
+  Adjacency(const unsigned int *indices, std::size_t indexCount,
+            std::size_t vertexCount)
+      : offsets(vertexCount + 1, 0), triangles(indexCount)
+  {
+    for (std::size_t i = 0; i < indexCount; ++i)
+      offsets[indices[i] + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < indexCount; ++i)
+      triangles[fill[indices[i]]++] = i / 3;
+  }
+
+  unsigned int count(unsigned int vertex) const
+  {
+    return offsets[vertex + 1] - offsets[vertex];
+  }
+};
+
+// Sander et al. "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw". Fans out around the vertex that is most likely still cached,
+// optional deadEnds gets the first triangle after every jump to a vertex
+// that wasn't a neighbour, the only places a cluster may start
+void tipsify(unsigned int *destination, const unsigned int *indices,
+             std::size_t indexCount, std::size_t vertexCount,
+             unsigned int cacheSize, std::vector<unsigned int> *deadEnds)
+{
+  const Adjacency adjacency(indices, indexCount, vertexCount);
+  std::vector<unsigned int> liveTriangles(vertexCount);
+  for (std::size_t v = 0; v < vertexCount; ++v)
+    liveTriangles[v] = adjacency.count(v);
+
+  std::vector<unsigned int> cacheTime(vertexCount, 0);
+  std::vector<char> emitted(indexCount / 3, 0);
+  std::vector<unsigned int> deadEndStack, candidates;
+  unsigned int time = cacheSize + 1;
+  std::size_t cursor = 0, written = 0;
+
+  auto next_live_vertex = [&]() -> int
+  {
+    while (!deadEndStack.empty())
+    {
+      unsigned int vertex = deadEndStack.back();
+      deadEndStack.pop_back();
+      if (liveTriangles[vertex] > 0)
+        return vertex;
+    }
+    for (; cursor < vertexCount; ++cursor)
+      if (liveTriangles[cursor] > 0)
+        return cursor;
+    return -1;
+  };
+
+  int fan = next_live_vertex();
+  if (deadEnds && fan >= 0)
+    deadEnds->push_back(0);
+  while (fan >= 0)
+  {
+    candidates.clear();
+    for (unsigned int t = adjacency.offsets[fan];
+         t < adjacency.offsets[fan + 1]; ++t)
+    {
+      unsigned int triangle = adjacency.triangles[t];
+      if (emitted[triangle])
+        continue;
+      emitted[triangle] = 1;
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int vertex = indices[triangle * 3 + k];
+        destination[written++] = vertex;
+        deadEndStack.push_back(vertex);
+        candidates.push_back(vertex);
+        liveTriangles[vertex]--;
+        if (time - cacheTime[vertex] > cacheSize)
+          cacheTime[vertex] = time++;
+      }
+    }
+
+    // the candidate still in cache after its remaining triangles are
+    // emitted, oldest first so it's used before it falls out
+    int next = -1, bestPriority = -1;
+    for (unsigned int vertex : candidates)
+    {
+      if (liveTriangles[vertex] == 0)
+        continue;
+      int priority = 0;
+      unsigned int age = time - cacheTime[vertex];
+      if (age + 2 * liveTriangles[vertex] <= cacheSize)
+        priority = age;
+      if (priority > bestPriority)
+      {
+        bestPriority = priority;
+        next = vertex;
+      }
+    }
+    if (next < 0)
+    {
+      next = next_live_vertex();
+      if (deadEnds && next >= 0)
+        deadEnds->push_back(written / 3);
+    }
+    fan = next;
+  }
+}
+
+// round to nearest half float. Denormals flush to zero, out of range goes
+// to infinity
+std::uint16_t quantize_half(float value)
+{
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  std::uint32_t sign = (bits >> 16) & 0x8000u;
+  std::uint32_t magnitude = bits & 0x7fffffffu;
+
+  if (magnitude > 0x7f800000u)
+    return sign | 0x7e00u; // nan
+  if (magnitude >= 0x477ff000u)
+    return sign | 0x7c00u; // rounds past 65504
+  if (magnitude < 0x38800000u)
+    return sign; // below the smallest normal half
+  // rebias the exponent from 127 to 15 and round the dropped mantissa bits
+  return sign | ((magnitude - 0x38000000u + 0x1000u) >> 13);
+}
+
+std::int16_t quantize_snorm16(float value)
+{
+  value = std::clamp(value, -1.0f, 1.0f);
+  return static_cast<std::int16_t>(std::lround(value * 32767.0f));
+}
+
+// unit vector onto the octahedron, lower half folded over the upper
+glm::vec2 encode_octahedral(glm::vec3 normal)
+{
+  float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (sum <= 0.0f)
+    return glm::vec2(0.0f);
+  normal /= sum;
+  glm::vec2 encoded(normal.x, normal.y);
+  if (normal.z < 0.0f)
+  {
+    glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f,
+                   encoded.y >= 0.0f ? 1.0f : -1.0f);
+    encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+  }
+  return encoded;
+}
+} // namespace
+
+namespace MeshOptimizer
+{
+
+VertexCacheStatistics analyze_vertex_cache(const unsigned int *indices,
+                                           std::size_t indexCount,
+                                           std::size_t vertexCount,
+                                           unsigned int cacheSize)
+{
+  std::vector<unsigned int> cacheTime(vertexCount, 0);
+  std::vector<char> used(vertexCount, 0);
+  unsigned int time = cacheSize + 1;
+  std::size_t misses = 0, usedVertices = 0;
+  for (std::size_t i = 0; i < indexCount; ++i)
+  {
+    unsigned int vertex = indices[i];
+    if (time - cacheTime[vertex] > cacheSize)
+    {
+      cacheTime[vertex] = time++;
+      misses++;
+    }
+    if (!used[vertex])
+    {
+      used[vertex] = 1;
+      usedVertices++;
+    }
+  }
+
+  VertexCacheStatistics statistics{};
+  if (indexCount > 0)
+  {
+    statistics.acmr = float(misses) / float(indexCount / 3);
+    statistics.atvr = float(misses) / float(usedVertices);
+  }
+  return statistics;
+}
+
+void optimize_vertex_cache(unsigned int *destination,
+                           const unsigned int *indices, std::size_t indexCount,
+                           std::size_t vertexCount)
+{
+  tipsify(destination, indices, indexCount, vertexCount, VERTEX_CACHE_SIZE,
+          nullptr);
+}
+
+void optimize_overdraw(unsigned int *destination, const unsigned int *indices,
+                       std::size_t indexCount, const Vertex *vertices,
+                       std::size_t vertexCount, float threshold)
+{
+  std::vector<unsigned int> ordered(indexCount);
+  std::vector<unsigned int> deadEnds;
+  tipsify(ordered.data(), indices, indexCount, vertexCount, VERTEX_CACHE_SIZE,
+          &deadEnds);
+  const std::size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+    return;
+
+  // keep a dead end as cluster start only if the cluster before it, run
+  // from a cold cache, stays within threshold of the whole mesh's misses
+  const float meshAcmr =
+      analyze_vertex_cache(ordered.data(), indexCount, vertexCount).acmr;
+  std::vector<unsigned int> clusters{0};
+  {
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    std::size_t misses = 0, nextDeadEnd = 1;
+    for (std::size_t t = 0; t < triangleCount; ++t)
+    {
+      if (nextDeadEnd < deadEnds.size() && deadEnds[nextDeadEnd] == t)
+      {
+        nextDeadEnd++;
+        std::size_t clusterTriangles = t - clusters.back();
+        if (misses <= threshold * meshAcmr * clusterTriangles)
+        {
+          clusters.push_back(t);
+          time += VERTEX_CACHE_SIZE + 1; // start cold
+          misses = 0;
+        }
+      }
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int vertex = ordered[t * 3 + k];
+        if (time - cacheTime[vertex] > VERTEX_CACHE_SIZE)
+        {
+          cacheTime[vertex] = time++;
+          misses++;
+        }
+      }
+    }
+  }
+
+  // area weighted centroid and normal per cluster
+  struct Cluster
+  {
+    unsigned int first, count;
+    float sortKey;
+  };
+  std::vector<Cluster> sorted;
+  std::vector<glm::vec3> centroids, normals;
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for (std::size_t c = 0; c < clusters.size(); ++c)
+  {
+    unsigned int first = clusters[c];
+    unsigned int end = c + 1 < clusters.size() ? clusters[c + 1]
+                                               : unsigned(triangleCount);
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (unsigned int t = first; t < end; ++t)
+    {
+      const glm::vec3 &p0 = vertices[ordered[t * 3]].position;
+      const glm::vec3 &p1 = vertices[ordered[t * 3 + 1]].position;
+      const glm::vec3 &p2 = vertices[ordered[t * 3 + 2]].position;
+      glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+      float triangleArea = glm::length(cross);
+      centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+      normal += cross;
+      area += triangleArea;
+    }
+    meshCentroid += centroid;
+    meshArea += area;
+    centroids.push_back(area > 0.0f ? centroid / area : centroid);
+    normals.push_back(normal);
+    sorted.push_back({first, end - first, 0.0f});
+  }
+  if (meshArea > 0.0f)
+    meshCentroid /= meshArea;
+
+  for (std::size_t c = 0; c < sorted.size(); ++c)
+  {
+    float length = glm::length(normals[c]);
+    glm::vec3 direction = length > 0.0f ? normals[c] / length : normals[c];
+    sorted[c].sortKey = glm::dot(centroids[c] - meshCentroid, direction);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Cluster &a, const Cluster &b)
+                   { return a.sortKey > b.sortKey; });
+
+  std::size_t written = 0;
+  for (const Cluster &cluster : sorted)
+  {
+    std::copy_n(ordered.begin() + cluster.first * 3, cluster.count * 3,
+                destination + written);
+    written += cluster.count * 3;
+  }
+}
+
+std::size_t optimize_vertex_fetch_remap(unsigned int *remap,
+                                        const unsigned int *indices,
+                                        std::size_t indexCount,
+                                        std::size_t vertexCount)
+{
+  std::fill_n(remap, vertexCount, ~0u);
+  unsigned int next = 0;
+  for (std::size_t i = 0; i < indexCount; ++i)
+  {
+    if (remap[indices[i]] == ~0u)
+      remap[indices[i]] = next++;
+  }
+  return next;
+}
+
+void remap_index_buffer(unsigned int *indices, std::size_t indexCount,
+                        const unsigned int *remap)
+{
+  for (std::size_t i = 0; i < indexCount; ++i)
+    indices[i] = remap[indices[i]];
+}
+
+void remap_vertex_buffer(Vertex *destination, const Vertex *vertices,
+                         std::size_t vertexCount, const unsigned int *remap)
+{
+  for (std::size_t i = 0; i < vertexCount; ++i)
+  {
+    if (remap[i] != ~0u)
+      destination[remap[i]] = vertices[i];
+  }
+}
+
+std::size_t simplify(unsigned int *destination, const unsigned int *indices,
+                     std::size_t indexCount, const Vertex *vertices,
+                     std::size_t vertexCount, std::size_t targetIndexCount,
+                     float targetError, float *resultError)
+{
+  std::vector<unsigned int> result(indices, indices + indexCount);
+  const std::vector<unsigned int> canonical =
+      weld_positions(vertices, vertexCount);
+
+  // seam vertices can't move without tearing the uv/normal seam open
+  std::vector<char> locked(vertexCount, 0);
+  {
+    std::vector<unsigned int> copies(vertexCount, 0);
+    for (std::size_t i = 0; i < vertexCount; ++i)
+      copies[canonical[i]]++;
+    for (std::size_t i = 0; i < vertexCount; ++i)
+      locked[i] = copies[canonical[i]] > 1;
+  }
+  // border edges have no opposite edge, moving their vertices would shrink
+  // the outline of open meshes
+  {
+    auto key = [](unsigned int a, unsigned int b)
+    { return std::uint64_t(a) << 32 | b; };
+    std::unordered_set<std::uint64_t> edges;
+    edges.reserve(indexCount);
+    for (std::size_t i = 0; i < indexCount; i += 3)
+      for (int e = 0; e < 3; ++e)
+        edges.insert(key(canonical[result[i + e]],
+                         canonical[result[i + (e + 1) % 3]]));
+    std::vector<char> border(vertexCount, 0);
+    for (std::uint64_t edge : edges)
+    {
+      unsigned int a = edge >> 32, b = edge & 0xffffffffu;
+      if (!edges.contains(key(b, a)))
+        border[a] = border[b] = 1;
+    }
+    for (std::size_t i = 0; i < vertexCount; ++i)
+      locked[i] = locked[i] || border[canonical[i]];
+  }
+
+  // per canonical vertex, collapses merge them
+  std::vector<Quadric> quadrics(vertexCount, Quadric{});
+  for (std::size_t i = 0; i < indexCount; i += 3)
+  {
+    Quadric q = plane_quadric(vertices[result[i]].position,
+                              vertices[result[i + 1]].position,
+                              vertices[result[i + 2]].position);
+    for (int k = 0; k < 3; ++k)
+      quadrics[canonical[result[i + k]]].add(q);
+  }
+
+  const double maxCost = double(targetError) * targetError;
+  double largestCost = 0.0;
+  std::vector<Collapse> collapses;
+  std::vector<unsigned int> remap(vertexCount);
+  std::vector<char> touched(vertexCount);
+
+  // each pass picks the cheapest independent collapses, applies them and
+  // rebuilds the adjacency
+  while (result.size() > targetIndexCount)
+  {
+    const std::size_t triangleCount = result.size() / 3;
+
+    const Adjacency adjacency(result.data(), result.size(), vertexCount);
+
+    collapses.clear();
+    for (std::size_t i = 0; i < result.size(); i += 3)
+    {
+      for (int e = 0; e < 3; ++e)
+      {
+        unsigned int from = result[i + e], to = result[i + (e + 1) % 3];
+        for (int direction = 0; direction < 2; ++direction)
+        {
+          if (!locked[from])
+          {
+            Quadric q = quadrics[canonical[from]];
+            q.add(quadrics[canonical[to]]);
+            collapses.push_back({from, to, q.error(vertices[to].position)});
+          }
+          std::swap(from, to);
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b)
+              { return a.cost < b.cost; });
+
+    std::iota(remap.begin(), remap.end(), 0u);
+    std::fill(touched.begin(), touched.end(), 0);
+    const std::size_t trianglesToRemove =
+        triangleCount - targetIndexCount / 3;
+    std::size_t removed = 0, applied = 0;
+
+    for (const Collapse &collapse : collapses)
+    {
+      if (collapse.cost > maxCost || removed >= trianglesToRemove)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+
+      // reject collapses that flip a triangle around the moving vertex
+      const glm::vec3 &target = vertices[collapse.to].position;
+      bool flips = false;
+      std::size_t shared = 0;
+      for (unsigned int t = adjacency.offsets[collapse.from];
+           t < adjacency.offsets[collapse.from + 1] && !flips; ++t)
+      {
+        const unsigned int *tri = &result[adjacency.triangles[t] * 3];
+        if (tri[0] == collapse.to || tri[1] == collapse.to ||
+            tri[2] == collapse.to)
+        {
+          shared++; // this one degenerates and goes away
+          continue;
+        }
+        glm::vec3 p[3], moved[3];
+        for (int k = 0; k < 3; ++k)
+        {
+          p[k] = vertices[tri[k]].position;
+          moved[k] = tri[k] == collapse.from ? target : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+        flips = glm::dot(before, after) <= 0.0f;
+      }
+      if (flips)
+        continue;
+
+      // freeze every vertex of the affected triangles for this pass, so the
+      // flip test above stays valid for the remaining collapses
+      for (unsigned int t = adjacency.offsets[collapse.from];
+           t < adjacency.offsets[collapse.from + 1]; ++t)
+      {
+        const unsigned int *tri = &result[adjacency.triangles[t] * 3];
+        touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[canonical[collapse.to]].add(quadrics[canonical[collapse.from]]);
+      largestCost = std::max(largestCost, collapse.cost);
+      removed += shared;
+      applied++;
+    }
+    if (applied == 0)
+      break;
+
+    // apply and drop the triangles that lost their area
+    std::size_t write = 0;
+    for (std::size_t i = 0; i < result.size(); i += 3)
+    {
+      unsigned int a = remap[result[i]], b = remap[result[i + 1]],
+                   c = remap[result[i + 2]];
+      if (canonical[a] == canonical[b] || canonical[b] == canonical[c] ||
+          canonical[a] == canonical[c])
+        continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  if (resultError)
+    *resultError = static_cast<float>(std::sqrt(largestCost));
+  std::copy(result.begin(), result.end(), destination);
+  return result.size();
+}
+
+void quantize_vertices(PackedVertex *destination, const Vertex *vertices,
+                       std::size_t vertexCount, const glm::vec3 &boundsMin,
+                       const glm::vec3 &boundsMax)
+{
+  // flat meshes have a zero extent on some axis, everything maps to 0 there
+  glm::vec3 extent = boundsMax - boundsMin;
+  glm::vec3 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                  extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                  extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+  for (std::size_t i = 0; i < vertexCount; ++i)
+  {
+    const Vertex &vertex = vertices[i];
+    PackedVertex &packed = destination[i];
+
+    glm::vec3 unorm = glm::clamp((vertex.position - boundsMin) * scale,
+                                 glm::vec3(0.0f), glm::vec3(1.0f));
+    for (int k = 0; k < 3; ++k)
+      packed.position[k] =
+          static_cast<std::uint16_t>(std::lround(unorm[k] * 65535.0f));
+    packed.position[3] = 0;
+
+    glm::vec2 octahedral = encode_octahedral(vertex.normal);
+    packed.normal[0] = quantize_snorm16(octahedral.x);
+    packed.normal[1] = quantize_snorm16(octahedral.y);
+
+    packed.texcoord[0] = quantize_half(vertex.texcoord.x);
+    packed.texcoord[1] = quantize_half(vertex.texcoord.y);
+  }
+}
+
+glm::mat4 dequantize_matrix(const glm::vec3 &boundsMin,
+                            const glm::vec3 &boundsMax)
+{
+  return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin),
+                    boundsMax - boundsMin);
+}
+
+} // namespace MeshOptimizer
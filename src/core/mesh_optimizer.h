@@ -0,0 +1,77 @@
+#pragma once
+
+#include "core/core.h"
+
+#include <cstddef>
+
+// offline processing of indexed triangle meshes, run at import time before
+// the result goes into the model cache. Nothing here touches GL.
+// Index buffers are triangle lists of 32 bit indices
+namespace MeshOptimizer
+{
+// quadric error metric edge collapse. Writes a coarser index buffer of at
+// most targetIndexCount indices into destination, which must hold
+// indexCount. Vertices are kept as is, collapses move one end of an edge
+// onto the other, so every level of detail can share one vertex buffer.
+// Border and uv/normal seam vertices never move. Stops early when the next
+// collapse would move the surface further than targetError (mesh units).
+// Returns the index count, resultError gets the largest error introduced
+std::size_t simplify(unsigned int *destination, const unsigned int *indices,
+                     std::size_t indexCount, const Vertex *vertices,
+                     std::size_t vertexCount, std::size_t targetIndexCount,
+                     float targetError, float *resultError = nullptr);
+
+// post transform cache size the optimizations below assume. Real hardware
+// batches differently, but a 16 entry fifo predicts the ordering well
+constexpr unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStatistics
+{
+  float acmr; // average cache miss ratio, transformed vertices per triangle
+  float atvr; // average transform to vertex ratio, 1 is optimal
+};
+
+// simulate a fifo post transform cache over the index buffer
+VertexCacheStatistics
+analyze_vertex_cache(const unsigned int *indices, std::size_t indexCount,
+                     std::size_t vertexCount,
+                     unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// reorder triangles for post transform cache hits (tipsify). destination
+// and indices may not overlap
+void optimize_vertex_cache(unsigned int *destination,
+                           const unsigned int *indices, std::size_t indexCount,
+                           std::size_t vertexCount);
+
+// reorder triangles to cut overdraw while keeping cache locality, runs
+// optimize_vertex_cache itself. Splits the tipsify order into clusters
+// where that costs at most threshold times the cache misses, then draws
+// clusters facing away from the mesh center first, which tends to put
+// occluders before what they hide
+void optimize_overdraw(unsigned int *destination, const unsigned int *indices,
+                       std::size_t indexCount, const Vertex *vertices,
+                       std::size_t vertexCount, float threshold = 1.05f);
+
+// remap table that puts vertices in first use order for the index buffer,
+// so vertex fetch streams through memory. Unreferenced vertices map to
+// ~0u. Returns the new vertex count
+std::size_t optimize_vertex_fetch_remap(unsigned int *remap,
+                                        const unsigned int *indices,
+                                        std::size_t indexCount,
+                                        std::size_t vertexCount);
+// apply a remap table, in place is fine for indices
+void remap_index_buffer(unsigned int *indices, std::size_t indexCount,
+                        const unsigned int *remap);
+// destination must not overlap vertices
+void remap_vertex_buffer(Vertex *destination, const Vertex *vertices,
+                         std::size_t vertexCount, const unsigned int *remap);
+
+// pack into the 16 byte layout, positions relative to the given bounds
+void quantize_vertices(PackedVertex *destination, const Vertex *vertices,
+                       std::size_t vertexCount, const glm::vec3 &boundsMin,
+                       const glm::vec3 &boundsMax);
+// maps quantized positions back into the bounds
+glm::mat4 dequantize_matrix(const glm::vec3 &boundsMin,
+                            const glm::vec3 &boundsMax);
+
+} // namespace MeshOptimizer
@@ -0,0 +1,260 @@
+#include "model_cache.h"
+#include "core/util.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+
+namespace
+{
+constexpr char MAGIC[8] = {'C', 'L', 'M', 'O', 'D', 'E', 'L', '\0'};
+constexpr std::uint64_t BLOB_ALIGNMENT = 16;
+
+constexpr std::uint64_t align_up(std::uint64_t value, std::uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// blobs start right after the header
+constexpr std::uint64_t BLOB_BASE =
+    align_up(sizeof(ModelCache::Header), BLOB_ALIGNMENT);
+
+bool in_file(std::uint64_t offset, std::uint64_t size, std::uint64_t fileSize)
+{
+  return offset <= fileSize && size <= fileSize - offset;
+}
+} // namespace
+
+namespace ModelCache
+{
+
+std::filesystem::path get_cache_path(const std::filesystem::path &source)
+{
+  std::error_code ec;
+  std::filesystem::path absolute =
+      std::filesystem::weakly_canonical(source, ec);
+  std::uint64_t hash = hash_string((ec ? source : absolute).string());
+
+  std::stringstream name;
+  name << source.stem().string() << "-" << std::hex << std::setw(16)
+       << std::setfill('0') << hash << ".model";
+  return std::filesystem::path(CACHE_PATH "models") / name.str();
+}
+
+bool Reader::open(const std::filesystem::path &path, std::uint64_t sourceHash,
+                  std::uint32_t vertexSize)
+{
+  header = nullptr;
+  if (!file.open(path))
+    return false;
+
+  if (validate(path, sourceHash, vertexSize))
+    return true;
+
+  // unmap so the cache can be rewritten in place
+  header = nullptr;
+  file.close();
+  return false;
+}
+
+bool Reader::validate(const std::filesystem::path &path,
+                      std::uint64_t sourceHash, std::uint32_t vertexSize)
+{
+  if (file.size() < sizeof(Header))
+    return false;
+  const auto *h = reinterpret_cast<const Header *>(file.data());
+  if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      h->version != VERSION || h->vertexSize != vertexSize ||
+      h->fileSize != file.size())
+  {
+    std::cout << "Model cache " << path << " is from another version\n";
+    return false;
+  }
+  if (h->sourceHash != sourceHash)
+  {
+    std::cout << "Model cache " << path << " is stale\n";
+    return false;
+  }
+
+  // tables must be in bounds before anything indexes them
+  if (!in_file(h->meshTableOffset, h->meshCount * sizeof(MeshRecord),
+               file.size()) ||
+      !in_file(h->textureTableOffset, h->textureCount * sizeof(TextureRecord),
+               file.size()) ||
+      !in_file(h->nodeTableOffset, h->nodeCount * sizeof(NodeRecord),
+               file.size()) ||
+      !in_file(h->materialTableOffset,
+               h->materialCount * sizeof(MaterialRecord), file.size()))
+    return false;
+
+  header = h;
+  auto valid_texture = [&](std::int32_t index)
+  { return index >= -1 && index < std::int32_t(h->textureCount); };
+  for (const MeshRecord &mesh : meshes())
+  {
+    if (!in_file(mesh.vertexOffset, mesh.vertexCount * vertexSize,
+                 file.size()) ||
+        mesh.lodCount < 1 || mesh.lodCount > MAX_LODS ||
+        mesh.node >= h->nodeCount || mesh.material >= h->materialCount)
+      return false;
+    for (std::uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+    {
+      if (!in_file(mesh.lods[lod].indexOffset,
+                   mesh.lods[lod].indexCount * sizeof(std::uint32_t),
+                   file.size()))
+        return false;
+    }
+  }
+  for (const MaterialRecord &material : materials())
+  {
+    if (!valid_texture(material.diffuseTexture))
+      return false;
+  }
+  // parents first, so loading can add nodes in table order
+  for (std::uint32_t i = 0; i < h->nodeCount; ++i)
+  {
+    std::uint32_t parent = nodes()[i].parent;
+    if (parent != ~0u && parent >= i)
+      return false;
+  }
+  for (const TextureRecord &texture : textures())
+  {
+    if (texture.width <= 0 || texture.height <= 0 || texture.levelCount <= 0 ||
+        texture.levelCount > 32 ||
+        texture.format < TextureCompress::Format::NONE ||
+        texture.format > TextureCompress::Format::BC7)
+      return false;
+    std::uint64_t chainSize = 0;
+    for (int level = 0; level < texture.levelCount; ++level)
+      chainSize += mip_level_size(texture, level);
+    if (chainSize != texture.dataSize ||
+        !in_file(texture.dataOffset, texture.dataSize, file.size()))
+      return false;
+  }
+  return true;
+}
+
+std::span<const MeshRecord> Reader::meshes() const
+{
+  if (!header)
+    return {};
+  return {reinterpret_cast<const MeshRecord *>(at(header->meshTableOffset)),
+          header->meshCount};
+}
+
+std::span<const TextureRecord> Reader::textures() const
+{
+  if (!header)
+    return {};
+  return {
+      reinterpret_cast<const TextureRecord *>(at(header->textureTableOffset)),
+      header->textureCount};
+}
+
+std::span<const NodeRecord> Reader::nodes() const
+{
+  if (!header)
+    return {};
+  return {reinterpret_cast<const NodeRecord *>(at(header->nodeTableOffset)),
+          header->nodeCount};
+}
+
+std::span<const MaterialRecord> Reader::materials() const
+{
+  if (!header)
+    return {};
+  return {reinterpret_cast<const MaterialRecord *>(
+              at(header->materialTableOffset)),
+          header->materialCount};
+}
+
+const std::uint64_t Writer::blobBase = BLOB_BASE;
+
+std::uint64_t Writer::allocate(std::size_t size)
+{
+  std::size_t start = align_up(blobs.size(), BLOB_ALIGNMENT);
+  blobs.resize(start + size);
+  return BLOB_BASE + start;
+}
+
+std::uint64_t Writer::append(const void *data, std::size_t size)
+{
+  std::uint64_t offset = allocate(size);
+  std::memcpy(at(offset), data, size);
+  return offset;
+}
+
+std::int32_t Writer::add_texture(const TextureRecord &record)
+{
+  textureRecords.push_back(record);
+  return static_cast<std::int32_t>(textureRecords.size() - 1);
+}
+
+bool Writer::write(const std::filesystem::path &path, std::uint64_t sourceHash,
+                   std::uint32_t vertexSize) const
+{
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.vertexSize = vertexSize;
+  header.sourceHash = sourceHash;
+  header.meshCount = static_cast<std::uint32_t>(meshRecords.size());
+  header.textureCount = static_cast<std::uint32_t>(textureRecords.size());
+  header.nodeCount = static_cast<std::uint32_t>(nodeRecords.size());
+  header.materialCount = static_cast<std::uint32_t>(materialRecords.size());
+  header.meshTableOffset = align_up(BLOB_BASE + blobs.size(), BLOB_ALIGNMENT);
+  header.textureTableOffset =
+      header.meshTableOffset + meshRecords.size() * sizeof(MeshRecord);
+  header.nodeTableOffset =
+      header.textureTableOffset + textureRecords.size() * sizeof(TextureRecord);
+  header.materialTableOffset =
+      header.nodeTableOffset + nodeRecords.size() * sizeof(NodeRecord);
+  header.fileSize = header.materialTableOffset +
+                    materialRecords.size() * sizeof(MaterialRecord);
+
+  // write next to the target and rename, so a crash never leaves a half
+  // written cache that looks valid
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  std::filesystem::path tempPath = path;
+  tempPath += ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+      std::cerr << "Failed to write model cache: " << path << "\n";
+      return false;
+    }
+    const char zeros[BLOB_ALIGNMENT] = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(zeros, BLOB_BASE - sizeof(header));
+    file.write(reinterpret_cast<const char *>(blobs.data()), blobs.size());
+    file.write(zeros,
+               header.meshTableOffset - (BLOB_BASE + blobs.size()));
+    file.write(reinterpret_cast<const char *>(meshRecords.data()),
+               meshRecords.size() * sizeof(MeshRecord));
+    file.write(reinterpret_cast<const char *>(textureRecords.data()),
+               textureRecords.size() * sizeof(TextureRecord));
+    file.write(reinterpret_cast<const char *>(nodeRecords.data()),
+               nodeRecords.size() * sizeof(NodeRecord));
+    file.write(reinterpret_cast<const char *>(materialRecords.data()),
+               materialRecords.size() * sizeof(MaterialRecord));
+    if (!file)
+    {
+      std::cerr << "Failed to write model cache: " << path << "\n";
+      return false;
+    }
+  }
+  std::filesystem::rename(tempPath, path, ec);
+  if (ec)
+  {
+    std::cerr << "Failed to write model cache: " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+} // namespace ModelCache
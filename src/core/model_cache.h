@@ -0,0 +1,167 @@
+#pragma once
+
+#include "core/mapped_file.h"
+#include "core/texture_compress.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// cooked, memory mappable form of a loaded model. load_gltf writes it on
+// first load and maps it on later launches. Vertex/index blobs are stored in
+// the layout the GPU consumes and textures are stored fully mipmapped, so
+// loading is a straight copy into GL objects with no parsing or decoding.
+//
+// file layout: Header, blobs (16 byte aligned), MeshRecord table,
+// TextureRecord table, NodeRecord table, MaterialRecord table. Offsets are in
+// bytes from the start of the file
+namespace ModelCache
+{
+constexpr std::uint32_t VERSION = 6;
+constexpr int MAX_LODS = 4;
+
+struct Header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t vertexSize; // sizeof(GPUVertex) when cooked
+  std::uint64_t sourceHash;
+  std::uint64_t fileSize;
+  std::uint64_t meshTableOffset;
+  std::uint64_t textureTableOffset;
+  std::uint64_t nodeTableOffset;
+  std::uint64_t materialTableOffset;
+  std::uint32_t meshCount;
+  std::uint32_t textureCount;
+  std::uint32_t nodeCount;
+  std::uint32_t materialCount;
+};
+
+// one index buffer of a mesh's level of detail chain
+struct LodRecord
+{
+  std::uint64_t indexOffset, indexCount; // 32 bit indices
+  float error; // mesh space distance to the full detail surface
+  std::uint32_t reserved;
+};
+
+struct MeshRecord
+{
+  std::uint64_t vertexOffset, vertexCount;
+  // lod 0 is full detail, all levels index the same vertices
+  LodRecord lods[MAX_LODS];
+  std::uint32_t lodCount;
+  float boundsMin[3], boundsMax[3]; // also the quantization range
+  std::uint32_t node;     // scene node the mesh is drawn at
+  std::uint32_t material; // material table index
+};
+
+// levels are packed back to back from dataOffset, level i is
+// max(1, width >> i) by max(1, height >> i) texels, block compressed unless
+// format is NONE
+struct TextureRecord
+{
+  std::int32_t width, height;
+  std::int32_t numChannels; // of the source image
+  std::int32_t isLinear;
+  std::int32_t levelCount;
+  TextureCompress::Format format;
+  std::uint64_t dataOffset, dataSize;
+};
+
+// scene graph node, in SceneGraph order: parents before children, depth
+// first
+struct NodeRecord
+{
+  std::uint32_t parent; // SceneGraph::NO_PARENT for roots
+  std::uint32_t reserved[3];
+  float localMatrix[16]; // column major
+};
+
+struct MaterialRecord
+{
+  float baseColor[4];
+  std::int32_t diffuseTexture = -1; // texture table index, -1 for none
+  std::int32_t reserved[3];
+};
+
+inline std::uint64_t mip_level_size(const TextureRecord &texture, int level)
+{
+  return TextureCompress::level_size(
+      texture.format, std::max(1, texture.width >> level),
+      std::max(1, texture.height >> level), texture.numChannels);
+}
+
+// cache file for a source model, keyed by the source path
+std::filesystem::path get_cache_path(const std::filesystem::path &source);
+
+// validated view of a mapped cache file
+class Reader
+{
+private:
+  MappedFile file;
+  const Header *header = nullptr;
+
+  bool validate(const std::filesystem::path &path, std::uint64_t sourceHash,
+                std::uint32_t vertexSize);
+
+public:
+  // false if missing, corrupt, from another version or a stale source
+  bool open(const std::filesystem::path &path, std::uint64_t sourceHash,
+            std::uint32_t vertexSize);
+
+  std::span<const MeshRecord> meshes() const;
+  std::span<const TextureRecord> textures() const;
+  std::span<const NodeRecord> nodes() const;
+  std::span<const MaterialRecord> materials() const;
+  const unsigned char *at(std::uint64_t offset) const
+  {
+    return file.data() + offset;
+  }
+};
+
+// collects blobs and records in memory, then writes the file in one go
+class Writer
+{
+private:
+  std::vector<unsigned char> blobs;
+  std::vector<MeshRecord> meshRecords;
+  std::vector<TextureRecord> textureRecords;
+  std::vector<NodeRecord> nodeRecords;
+  std::vector<MaterialRecord> materialRecords;
+  static const std::uint64_t blobBase;
+
+public:
+  void reserve(std::size_t blobBytes)
+  {
+    blobs.reserve(blobs.size() + blobBytes);
+  }
+  // returns the file offset the data will end up at
+  std::uint64_t append(const void *data, std::size_t size);
+  // reserve zeroed space to be filled in place through at(). Returns the
+  // file offset
+  std::uint64_t allocate(std::size_t size);
+  // only valid until the next append/allocate, which may move the blobs
+  unsigned char *at(std::uint64_t offset)
+  {
+    return blobs.data() + (offset - blobBase);
+  }
+  void add_mesh(const MeshRecord &record) { meshRecords.push_back(record); }
+  // returns the texture table index
+  std::int32_t add_texture(const TextureRecord &record);
+  void add_node(const NodeRecord &record) { nodeRecords.push_back(record); }
+  // returns the material table index
+  std::uint32_t add_material(const MaterialRecord &record)
+  {
+    materialRecords.push_back(record);
+    return static_cast<std::uint32_t>(materialRecords.size() - 1);
+  }
+
+  bool write(const std::filesystem::path &path, std::uint64_t sourceHash,
+             std::uint32_t vertexSize) const;
+};
+
+} // namespace ModelCache
@@ -0,0 +1,109 @@
+#include "scene_graph.h"
+#include "core/thread_pool.h"
+
+std::uint32_t SceneGraph::add_node(std::uint32_t parent,
+                                   const glm::mat4 &localMatrix)
+{
+  const auto node = static_cast<std::uint32_t>(parents.size());
+  parents.push_back(parent);
+  subtreeEnds.push_back(node + 1);
+  localMatrices.push_back(localMatrix);
+  worldMatrices.push_back(localMatrix);
+  dirty.push_back(1);
+  anyDirty = true;
+
+  // grow the open subtrees this node lands in
+  for (std::uint32_t ancestor = parent; ancestor != NO_PARENT;
+       ancestor = parents[ancestor])
+    subtreeEnds[ancestor] = node + 1;
+  return node;
+}
+
+void SceneGraph::reserve(std::size_t nodeCount)
+{
+  parents.reserve(nodeCount);
+  subtreeEnds.reserve(nodeCount);
+  localMatrices.reserve(nodeCount);
+  worldMatrices.reserve(nodeCount);
+  dirty.reserve(nodeCount);
+}
+
+void SceneGraph::set_local_matrix(std::uint32_t node,
+                                  const glm::mat4 &localMatrix)
+{
+  localMatrices[node] = localMatrix;
+  dirty[node] = 1;
+  anyDirty = true;
+}
+
+void SceneGraph::compute_world(std::uint32_t node)
+{
+  const std::uint32_t parent = parents[node];
+  worldMatrices[node] = parent == NO_PARENT
+                            ? localMatrices[node]
+                            : worldMatrices[parent] * localMatrices[node];
+  dirty[node] = 0;
+}
+
+// cut a dirty subtree into ranges of at most TASK_NODES that can run in any
+// order. A big subtree's root is computed here, after which each of its
+// children's subtrees only depends on finished nodes
+void SceneGraph::split_subtree(std::uint32_t root, std::vector<Range> &ranges)
+{
+  const std::uint32_t end = subtreeEnds[root];
+  if (end - root <= TASK_NODES)
+  {
+    ranges.push_back({root, end});
+    return;
+  }
+  compute_world(root);
+  for (std::uint32_t child = root + 1; child < end; child = subtreeEnds[child])
+    split_subtree(child, ranges);
+}
+
+bool SceneGraph::update()
+{
+  if (!anyDirty)
+    return false;
+  anyDirty = false;
+
+  // topmost dirty nodes, everything below them is recomputed anyway
+  std::vector<Range> ranges;
+  const auto nodeCount = static_cast<std::uint32_t>(size());
+  for (std::uint32_t node = 0; node < nodeCount;)
+  {
+    if (!dirty[node])
+    {
+      ++node;
+      continue;
+    }
+    split_subtree(node, ranges);
+    node = subtreeEnds[node];
+  }
+
+  // pack neighbouring ranges into tasks of about TASK_NODES
+  std::vector<std::size_t> taskStarts; // first range of each task
+  std::uint32_t taskNodes = TASK_NODES;
+  for (std::size_t i = 0; i < ranges.size(); ++i)
+  {
+    if (taskNodes >= TASK_NODES)
+    {
+      taskStarts.push_back(i);
+      taskNodes = 0;
+    }
+    taskNodes += ranges[i].second - ranges[i].first;
+  }
+  taskStarts.push_back(ranges.size());
+  const std::size_t taskCount = taskStarts.size() - 1;
+
+  auto run_task = [&](std::size_t task)
+  {
+    for (std::size_t i = taskStarts[task]; i < taskStarts[task + 1]; ++i)
+      for (std::uint32_t node = ranges[i].first; node < ranges[i].second;
+           ++node)
+        compute_world(node);
+  };
+
+  ThreadPool::shared().run_tasks(taskCount, run_task);
+  return true;
+}
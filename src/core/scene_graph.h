@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/ext/matrix_float4x4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// node hierarchy of a scene, flattened into arrays in depth first order. A
+// parent always comes before its children and every subtree is one
+// contiguous index range, so world matrices are computed in a single linear
+// sweep with no pointer chasing. Only subtrees under a changed local matrix
+// are recomputed, large updates are split across the thread pool
+class SceneGraph
+{
+private:
+  std::vector<std::uint32_t> parents;
+  std::vector<std::uint32_t> subtreeEnds; // one past the last descendant
+  std::vector<glm::mat4> localMatrices;
+  std::vector<glm::mat4> worldMatrices;
+  std::vector<std::uint8_t> dirty; // local matrix changed since update
+  bool anyDirty = false;
+
+  using Range = std::pair<std::uint32_t, std::uint32_t>; // [first, end)
+
+  void compute_world(std::uint32_t node);
+  void split_subtree(std::uint32_t root, std::vector<Range> &ranges);
+
+public:
+  static constexpr std::uint32_t NO_PARENT = ~0u;
+  // nodes per update task, smaller updates stay on the calling thread
+  static constexpr std::uint32_t TASK_NODES = 1024;
+
+  // append a node. Nodes must be added depth first: parent is NO_PARENT or
+  // the last added node or one of its ancestors. Returns the node index
+  std::uint32_t add_node(std::uint32_t parent, const glm::mat4 &localMatrix);
+  void reserve(std::size_t nodeCount);
+
+  void set_local_matrix(std::uint32_t node, const glm::mat4 &localMatrix);
+  const glm::mat4 &get_local_matrix(std::uint32_t node) const
+  {
+    return localMatrices[node];
+  }
+  // valid after update()
+  const glm::mat4 &get_world_matrix(std::uint32_t node) const
+  {
+    return worldMatrices[node];
+  }
+  std::uint32_t get_parent(std::uint32_t node) const { return parents[node]; }
+  std::size_t size() const { return parents.size(); }
+
+  // recompute world matrices below changed nodes. Returns false if nothing
+  // changed
+  bool update();
+};
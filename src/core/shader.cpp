@@ -1,8 +1,14 @@
 #include "shader.h"
+#include "core/util.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
 #include <glm/ext/matrix_float2x2.hpp>
 #include <glm/ext/matrix_float2x3.hpp>
 #include <glm/ext/matrix_float2x4.hpp>
@@ -25,66 +31,412 @@
 #include <sstream>
 #include <iostream>
 #include <gldoc.hpp>
+#include <cstdlib>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// startup report. Compares full compiles against binary cache hits
+struct ShaderBuildStats
+{
+  int compiled = 0;
+  int cacheHits = 0;
+  double compileMs = 0;
+  double cacheHitMs = 0;
+} buildStats;
+
+constexpr std::uint32_t PROGRAM_CACHE_MAGIC = 0x50524f47; // "PROG"
+
+struct ProgramCacheHeader
+{
+  std::uint32_t magic;
+  std::uint32_t binaryFormat;
+};
+
+bool is_program_cache_supported()
+{
+  static const bool supported = []
+  {
+    int formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+  }();
+  return supported;
+}
+
+// binaries are only valid for the exact driver that produced them, so the
+// renderer and version strings are part of the key
+using StageSources = std::vector<std::pair<unsigned int, std::string>>;
+
+std::filesystem::path program_cache_path(const StageSources &stages)
+{
+  std::uint64_t hash = hash_string(
+      reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+  hash = hash_string(reinterpret_cast<const char *>(glGetString(GL_VERSION)),
+                     hash);
+  for (const auto &[type, code] : stages)
+  {
+    hash = hash_bytes(&type, sizeof(type), hash);
+    hash = hash_string(code, hash);
+  }
+
+  std::stringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return std::filesystem::path(CACHE_PATH "shaders") / name.str();
+}
+
+// hands a cached binary to the driver. Returns false on a cache miss. Whether
+// the driver accepted it is only known later, see program_binary_linked
+bool try_program_binary(unsigned int program,
+                        const std::filesystem::path &cachePath)
+{
+  std::ifstream file(cachePath, std::ios::binary);
+  if (!file)
+    return false;
+
+  ProgramCacheHeader header{};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || header.magic != PROGRAM_CACHE_MAGIC)
+    return false;
+
+  std::vector<char> binary((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+
+  glProgramBinary(program, header.binaryFormat, binary.data(),
+                  static_cast<int>(binary.size()));
+  return true;
+}
+
+// false when the driver rejected a binary (driver update etc)
+bool program_binary_linked(unsigned int program,
+                           const std::filesystem::path &cachePath)
+{
+  int success = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success)
+  {
+    std::cout << "Program binary " << cachePath.filename()
+              << " rejected by driver, recompiling\n";
+  }
+  return success;
+}
+
+void save_program_binary(unsigned int program,
+                         const std::filesystem::path &cachePath)
+{
+  int length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<char> binary(length);
+  GLenum binaryFormat = 0;
+  glGetProgramBinary(program, length, nullptr, &binaryFormat, binary.data());
+
+  std::error_code ec;
+  std::filesystem::create_directories(cachePath.parent_path(), ec);
+  std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+  if (!file)
+  {
+    std::cerr << "Failed to write program binary: " << cachePath << "\n";
+    return;
+  }
+  ProgramCacheHeader header{PROGRAM_CACHE_MAGIC, binaryFormat};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(binary.data(), length);
+}
+const char *stage_name(unsigned int type)
+{
+  if (type == GL_VERTEX_SHADER)
+    return "VERTEX";
+  if (type == GL_FRAGMENT_SHADER)
+    return "FRAGMENT";
+  return "COMPUTE";
+}
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile. Not part of
+// the glad profile, so the enum and entry point are set up by hand
+constexpr GLenum COMPLETION_STATUS_KHR = 0x91B1;
+using PFNMaxShaderCompilerThreads = void(GLAD_API_PTR *)(GLuint count);
+
+bool has_extension(std::string_view name)
+{
+  int count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (int i = 0; i < count; ++i)
+  {
+    const auto *ext =
+        reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+    if (ext && name == ext)
+      return true;
+  }
+  return false;
+}
+
+bool is_parallel_compile_supported()
+{
+  static const bool supported =
+      has_extension("GL_KHR_parallel_shader_compile") ||
+      has_extension("GL_ARB_parallel_shader_compile");
+  return supported;
+}
+
+void enable_parallel_compile()
+{
+  static bool enabled = false;
+  if (enabled || !is_parallel_compile_supported())
+    return;
+  enabled = true;
+
+  auto maxThreads = reinterpret_cast<PFNMaxShaderCompilerThreads>(
+      glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+  if (!maxThreads)
+  {
+    maxThreads = reinterpret_cast<PFNMaxShaderCompilerThreads>(
+        glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+  }
+  if (maxThreads)
+    maxThreads(0xFFFFFFFF); // let the driver pick the thread count
+
+  std::cout << "Parallel shader compile enabled\n";
+}
+} // namespace
 
 Shader::Shader(const std::filesystem::path &vertexPath,
-               const std::filesystem::path &fragmentPath)
+               const std::filesystem::path &fragmentPath,
+               const ShaderDefines &defines)
 {
-  std::string vertCode = read_file_into_string(vertexPath);
-  std::string fragCode = read_file_into_string(fragmentPath);
+  ShaderBatch batch;
+  batch.add(*this, vertexPath, fragmentPath, defines);
+  batch.submit();
+  batch.finish();
+}
 
-  unsigned int vertShader, fragShader;
-  compile_shader(vertCode.c_str(), GL_VERTEX_SHADER, vertShader, vertexPath);
-  compile_shader(fragCode.c_str(), GL_FRAGMENT_SHADER, fragShader,
-                 fragmentPath);
+Shader::Shader(const std::filesystem::path &computePath,
+               const ShaderDefines &defines)
+{
+  ShaderBatch batch;
+  batch.add(*this, computePath, defines);
+  batch.submit();
+  batch.finish();
+}
 
-  program = glCreateProgram();
-  std::cout << vertexPath.filename().c_str() << ", "
-            << fragmentPath.filename().c_str() << " id: " << program << "\n";
+void Shader::print_build_stats()
+{
+  std::cout << "Shaders: " << buildStats.compiled << " compiled in "
+            << buildStats.compileMs << " ms, " << buildStats.cacheHits
+            << " loaded from binary cache in " << buildStats.cacheHitMs
+            << " ms\n";
+}
 
-  glAttachShader(program, vertShader);
-  glAttachShader(program, fragShader);
-  glLinkProgram(program);
+void ShaderBatch::add(Shader &target, const std::filesystem::path &vertexPath,
+                      const std::filesystem::path &fragmentPath,
+                      const ShaderDefines &defines)
+{
+  Pending p{};
+  p.target = &target;
+  p.stages = {{GL_VERTEX_SHADER, vertexPath},
+              {GL_FRAGMENT_SHADER, fragmentPath}};
+  p.defines = defines;
+  pending.push_back(std::move(p));
+}
 
-  check_compile_errors(program, "PROGRAM", "");
+void ShaderBatch::add(Shader &target, const std::filesystem::path &computePath,
+                      const ShaderDefines &defines)
+{
+  Pending p{};
+  p.target = &target;
+  p.stages = {{GL_COMPUTE_SHADER, computePath}};
+  p.defines = defines;
+  pending.push_back(std::move(p));
+}
 
-  glDeleteShader(vertShader);
-  glDeleteShader(fragShader);
+void ShaderBatch::submit()
+{
+  enable_parallel_compile();
+
+  submitTime = std::chrono::steady_clock::now();
+  for (Pending &p : pending)
+    submit_one(p);
+  submitted = true;
 }
 
-Shader::Shader(const std::filesystem::path &computePath)
+// issue the work for one program but never ask the driver for a status here,
+// that would force it to finish compiling right away
+void ShaderBatch::submit_one(Pending &p)
 {
-  std::string computeCode = read_file_into_string(computePath);
+  for (const auto &[type, path] : p.stages)
+  {
+    std::vector<std::filesystem::path> &files = p.sourceFiles.emplace_back();
+    p.sources.emplace_back(
+        type, p.target->read_file_into_string(path, p.defines, &files));
+    p.label += (p.label.empty() ? "" : ", ") + path.filename().string();
+  }
 
-  unsigned int computeShader;
-  compile_shader(computeCode.c_str(), GL_COMPUTE_SHADER, computeShader,
-                 computePath);
+  const bool useCache = is_program_cache_supported();
+  if (useCache)
+    p.cachePath = program_cache_path(p.sources);
 
-  program = glCreateProgram();
-  std::cout << computePath.filename().c_str() << " id: " << program << "\n";
-  glAttachShader(program, computeShader);
-  glLinkProgram(program);
+  p.program = glCreateProgram();
+  if (useCache && try_program_binary(p.program, p.cachePath))
+  {
+    p.fromCache = true;
+    return;
+  }
 
-  check_compile_errors(program, "PROGRAM", "");
+  for (std::size_t i = 0; i < p.stages.size(); ++i)
+  {
+    unsigned int shaderID;
+    p.target->compile_shader(p.sources[i].second.c_str(), p.stages[i].first,
+                             shaderID);
+    glAttachShader(p.program, shaderID);
+    p.shaderIDs.push_back(shaderID);
+  }
 
-  glDeleteShader(computeShader);
+  if (useCache)
+    glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  glLinkProgram(p.program);
+}
+
+void ShaderBatch::finish()
+{
+  if (!submitted)
+    submit();
+
+  using Clock = std::chrono::steady_clock;
+  auto elapsed_ms = [&]
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - submitTime)
+        .count();
+  };
+
+  if (is_parallel_compile_supported())
+  {
+    // poll until every program reports completion. Each program's time is
+    // measured from submission to its own completion
+    std::size_t remaining = pending.size();
+    while (remaining > 0)
+    {
+      for (Pending &p : pending)
+      {
+        if (p.done)
+          continue;
+        int complete = GL_FALSE;
+        glGetProgramiv(p.program, COMPLETION_STATUS_KHR, &complete);
+        if (complete)
+        {
+          complete_one(p);
+          p.buildMs = elapsed_ms();
+          remaining--;
+        }
+      }
+      if (remaining > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+  else
+  {
+    // status queries block, so this finishes programs in order
+    for (Pending &p : pending)
+    {
+      complete_one(p);
+      p.buildMs = elapsed_ms();
+    }
+  }
+
+  for (Pending &p : pending)
+  {
+    if (p.fromCache)
+    {
+      buildStats.cacheHits++;
+      buildStats.cacheHitMs += p.buildMs;
+    }
+    else
+    {
+      buildStats.compiled++;
+      buildStats.compileMs += p.buildMs;
+    }
+    std::cout << p.label << " id: " << p.program << " ("
+              << (p.fromCache ? "binary cache" : "compiled") << ", "
+              << p.buildMs << " ms)\n";
+  }
+  pending.clear();
+  submitted = false;
+}
+
+void ShaderBatch::complete_one(Pending &p)
+{
+  p.done = true;
+  Shader &shader = *p.target;
+
+  if (p.fromCache && !program_binary_linked(p.program, p.cachePath))
+  {
+    // driver rejected the binary (driver update etc). Compile from source,
+    // this one can't overlap with anything anymore
+    p.fromCache = false;
+    glDeleteProgram(p.program);
+    p.program = glCreateProgram();
+    for (std::size_t i = 0; i < p.stages.size(); ++i)
+    {
+      unsigned int shaderID;
+      shader.compile_shader(p.sources[i].second.c_str(), p.stages[i].first,
+                            shaderID);
+      glAttachShader(p.program, shaderID);
+      p.shaderIDs.push_back(shaderID);
+    }
+    glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+    glLinkProgram(p.program);
+  }
+
+  if (!p.fromCache)
+  {
+    for (std::size_t i = 0; i < p.shaderIDs.size(); ++i)
+    {
+      try
+      {
+        shader.check_compile_errors(p.shaderIDs[i],
+                                    stage_name(p.stages[i].first),
+                                    p.stages[i].second);
+      }
+      catch (const std::runtime_error &err)
+      {
+        // errors are reported as "source:line", list which file is which
+        std::string message = err.what();
+        message += "Source strings:\n";
+        const auto &files = p.sourceFiles[i];
+        for (std::size_t k = 0; k < files.size(); ++k)
+          message += "  " + std::to_string(k) + ": " + files[k].string() + "\n";
+        throw std::runtime_error(message);
+      }
+    }
+    shader.check_compile_errors(p.program, "PROGRAM", "");
+
+    for (unsigned int shaderID : p.shaderIDs)
+      glDeleteShader(shaderID);
+    p.shaderIDs.clear();
+
+    if (is_program_cache_supported())
+      save_program_binary(p.program, p.cachePath);
+  }
+
+  shader.program = p.program;
+  shader.reflect();
 }
 
 void Shader::compile_shader(const char *code, GLenum type,
-                            unsigned int &shaderID,
-                            const std::filesystem::path &filePath)
+                            unsigned int &shaderID)
 {
+  // status is checked later by the batch, after everything is submitted, and
+  // reported with the file
   shaderID = glCreateShader(type);
   glShaderSource(shaderID, 1, &code, nullptr);
   glCompileShader(shaderID);
-
-  check_compile_errors(
-      shaderID,
-      type == GL_VERTEX_SHADER
-          ? "VERTEX"
-          : (type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE"),
-      filePath);
 }
 
 void Shader::check_compile_errors(unsigned int program, const std::string &type,
@@ -122,135 +474,550 @@ void Shader::check_compile_errors(unsigned int program, const std::string &type,
   }
 }
 
-std::string Shader::read_file_into_string(const std::filesystem::path &filePath)
+std::string
+Shader::read_file_into_string(const std::filesystem::path &filePath,
+                              const ShaderDefines &defines,
+                              std::vector<std::filesystem::path> *sourceFiles)
+{
+  std::vector<std::filesystem::path> files;
+  std::string code;
+  append_source_file(filePath, code, files);
+
+  if (!defines.empty())
+  {
+    // defines must come after #version, which has to be the first directive
+    std::size_t versionPos = code.find("#version");
+    std::size_t insertPos = 0;
+    int versionLine = 0;
+    if (versionPos != std::string::npos)
+    {
+      insertPos = code.find('\n', versionPos);
+      insertPos = insertPos == std::string::npos ? code.size() : insertPos + 1;
+      versionLine = 1 + static_cast<int>(std::count(
+                            code.begin(), code.begin() + versionPos, '\n'));
+    }
+
+    std::string injected;
+    for (const auto &[name, value] : defines)
+      injected += "#define " + name + " " + value + "\n";
+    // keep line numbers of the main file intact
+    injected += "#line " + std::to_string(versionLine + 1) + " 0\n";
+    code.insert(insertPos, injected);
+  }
+
+  if (sourceFiles)
+    *sourceFiles = std::move(files);
+  return code;
+}
+
+void Shader::append_source_file(const std::filesystem::path &filePath,
+                                std::string &out,
+                                std::vector<std::filesystem::path> &sourceFiles)
 {
   std::ifstream file(filePath);
   if (!file)
   {
     throw std::runtime_error("Could not open file: " + filePath.string());
   }
-  std::stringstream stream;
-  stream << file.rdbuf();
-  return stream.str();
+
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(filePath);
+  if (std::find(sourceFiles.begin(), sourceFiles.end(), canonical) !=
+      sourceFiles.end())
+  {
+    return; // already included
+  }
+  const int sourceIndex = static_cast<int>(sourceFiles.size());
+  sourceFiles.push_back(canonical);
+
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line))
+  {
+    lineNumber++;
+
+    std::string_view view(line);
+    std::size_t first = view.find_first_not_of(" \t");
+    if (first == std::string_view::npos ||
+        !view.substr(first).starts_with("#include"))
+    {
+      out += line;
+      out += '\n';
+      continue;
+    }
+
+    std::size_t open = view.find('"', first);
+    std::size_t close = view.find('"', open + 1);
+    if (open == std::string_view::npos || close == std::string_view::npos)
+    {
+      throw std::runtime_error("Malformed #include in " + filePath.string() +
+                               ":" + std::to_string(lineNumber));
+    }
+    std::filesystem::path includePath =
+        filePath.parent_path() / view.substr(open + 1, close - open - 1);
+
+    out += "#line 1 " + std::to_string(sourceFiles.size()) + "\n";
+    append_source_file(includePath, out, sourceFiles);
+    // resume numbering of this file after the include
+    out += "#line " + std::to_string(lineNumber + 1) + " " +
+           std::to_string(sourceIndex) + "\n";
+  }
+}
+
+std::uint32_t ProgramResourceTable::hash_name(std::string_view name)
+{
+  // FNV-1a
+  std::uint32_t hash = 2166136261u;
+  for (char c : name)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void ProgramResourceTable::reserve(std::size_t resourceCount)
+{
+  // keep load factor <= 0.5 so probe sequences stay short
+  std::size_t capacity = 8;
+  while (capacity < resourceCount * 2)
+    capacity *= 2;
+
+  slots.assign(capacity, Slot{});
+  count = 0;
+}
+
+void ProgramResourceTable::insert(std::string_view name, int value)
+{
+  if ((count + 1) * 2 > slots.size())
+  {
+    // grow and rehash
+    std::vector<Slot> old = std::move(slots);
+    reserve(count + 1);
+    for (Slot &slot : old)
+    {
+      if (slot.occupied)
+        insert(slot.name, slot.value);
+    }
+  }
+
+  std::uint32_t hash = hash_name(name);
+  std::size_t mask = slots.size() - 1;
+  for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+  {
+    Slot &slot = slots[i];
+    if (!slot.occupied)
+    {
+      slot = {std::string(name), hash, value, true};
+      count++;
+      return;
+    }
+    if (slot.hash == hash && slot.name == name)
+    {
+      slot.value = value;
+      return;
+    }
+  }
+}
+
+int ProgramResourceTable::find(std::string_view name) const
+{
+  if (slots.empty())
+    return -1;
+
+  std::uint32_t hash = hash_name(name);
+  std::size_t mask = slots.size() - 1;
+  for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+  {
+    const Slot &slot = slots[i];
+    if (!slot.occupied)
+      return -1;
+    if (slot.hash == hash && slot.name == name)
+      return slot.value;
+  }
+}
+
+// enumerate active uniforms and blocks once, so uniform setting never has to
+// ask the driver for a location again
+void Shader::reflect()
+{
+  reflection = std::make_shared<ProgramReflection>();
+
+  auto resource_name = [&](GLenum interface, int index, int nameLength)
+  {
+    std::string name(nameLength, '\0');
+    glGetProgramResourceName(program, interface, index, nameLength, nullptr,
+                             name.data());
+    name.resize(nameLength - 1); // drop null terminator
+    return name;
+  };
+
+  // uniforms in the default block
+  {
+    int count = 0;
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    reflection->uniforms.reserve(count);
+
+    constexpr std::array<GLenum, 4> props = {GL_NAME_LENGTH, GL_LOCATION,
+                                             GL_BLOCK_INDEX, GL_ARRAY_SIZE};
+    for (int i = 0; i < count; ++i)
+    {
+      std::array<int, props.size()> values{};
+      glGetProgramResourceiv(program, GL_UNIFORM, i, props.size(),
+                             props.data(), values.size(), nullptr,
+                             values.data());
+      auto [nameLength, location, blockIndex, arraySize] = values;
+      if (blockIndex != -1)
+        continue; // uniform block members are set through buffers
+
+      std::string name = resource_name(GL_UNIFORM, i, nameLength);
+      reflection->uniforms.insert(name, location);
+
+      // arrays are reported as "name[0]". Also allow plain "name"
+      if (arraySize > 1 && name.ends_with("[0]"))
+      {
+        reflection->uniforms.insert(
+            std::string_view(name).substr(0, name.size() - 3), location);
+      }
+    }
+  }
+
+  // uniform and storage blocks
+  auto reflect_blocks = [&](GLenum interface, ProgramResourceTable &table)
+  {
+    int count = 0;
+    glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &count);
+    table.reserve(count);
+
+    constexpr std::array<GLenum, 2> props = {GL_NAME_LENGTH,
+                                             GL_BUFFER_BINDING};
+    for (int i = 0; i < count; ++i)
+    {
+      std::array<int, props.size()> values{};
+      glGetProgramResourceiv(program, interface, i, props.size(), props.data(),
+                             values.size(), nullptr, values.data());
+      auto [nameLength, binding] = values;
+      table.insert(resource_name(interface, i, nameLength), binding);
+    }
+  };
+  reflect_blocks(GL_UNIFORM_BLOCK, reflection->uniformBlocks);
+  reflect_blocks(GL_SHADER_STORAGE_BLOCK, reflection->storageBlocks);
+}
+
+int Shader::find_uniform_location(const char *name) const
+{
+  if (!reflection)
+    return -1;
+
+  int location = reflection->uniforms.find(name);
+  if (location != -1)
+    return location;
+
+  // element of an array, "name[i]" -> location of "name[0]" + i
+  std::string_view view(name);
+  if (view.ends_with(']'))
+  {
+    std::size_t open = view.rfind('[');
+    if (open != std::string_view::npos)
+    {
+      int base = reflection->uniforms.find(view.substr(0, open));
+      int index = std::atoi(std::string(view.substr(open + 1)).c_str());
+      if (base != -1)
+        return base + index;
+    }
+  }
+
+  if (!reflection->warnedNames.contains(name))
+  {
+    reflection->warnedNames.emplace(name);
+    std::cout << "Warning: uniform \"" << name
+              << "\" is not active in program " << program << "\n";
+  }
+  return -1;
+}
+
+int Shader::get_uniform_block_binding(const char *name) const
+{
+  return reflection ? reflection->uniformBlocks.find(name) : -1;
+}
+
+int Shader::get_storage_block_binding(const char *name) const
+{
+  return reflection ? reflection->storageBlocks.find(name) : -1;
 }
 
 void Shader::use() const { glUseProgram(program); }
 
+void Shader::upload(int location, bool value)
+{
+  glUniform1i(location, (int)value);
+}
+
+void Shader::upload(int location, int value) { glUniform1i(location, value); }
+
+void Shader::upload(int location, unsigned int value)
+{
+  glUniform1ui(location, value);
+}
+
+void Shader::upload(int location, float value)
+{
+  glUniform1f(location, value);
+}
+
+void Shader::upload(int location, const glm::vec2 &value)
+{
+  glUniform2fv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::ivec2 &value)
+{
+  glUniform2iv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::uvec2 &value)
+{
+  glUniform2uiv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::vec3 &value)
+{
+  glUniform3fv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::ivec3 &value)
+{
+  glUniform3iv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::uvec3 &value)
+{
+  glUniform3uiv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::vec4 &value)
+{
+  glUniform4fv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::ivec4 &value)
+{
+  glUniform4iv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::uvec4 &value)
+{
+  glUniform4uiv(location, 1, glm::value_ptr(value));
+}
+
+void Shader::upload(int location, const glm::mat2 &mat)
+{
+  glUniformMatrix2fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat3 &mat)
+{
+  glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat4 &mat)
+{
+  glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat2x3 &mat)
+{
+  glUniformMatrix2x3fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat3x2 &mat)
+{
+  glUniformMatrix3x2fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat2x4 &mat)
+{
+  glUniformMatrix2x4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat4x2 &mat)
+{
+  glUniformMatrix4x2fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat3x4 &mat)
+{
+  glUniformMatrix3x4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::upload(int location, const glm::mat4x3 &mat)
+{
+  glUniformMatrix4x3fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
 void Shader::set_bool(const char *name, bool value) const
 {
-  glUniform1i(glGetUniformLocation(program, name), (int)value);
+  set(get_uniform<bool>(name), value);
 }
 
 void Shader::set_int(const char *name, int value) const
 {
-  glUniform1i(glGetUniformLocation(program, name), value);
+  set(get_uniform<int>(name), value);
 }
 
 void Shader::set_uint(const char *name, unsigned int value) const
 {
-  glUniform1ui(glGetUniformLocation(program, name), value);
+  set(get_uniform<unsigned int>(name), value);
 }
 
 void Shader::set_float(const char *name, float value) const
 {
-  glUniform1f(glGetUniformLocation(program, name), value);
+  set(get_uniform<float>(name), value);
 }
 
 void Shader::set_vec2(const char *name, const glm::vec2 &value) const
 {
-  glUniform2fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::vec2>(name), value);
 }
 
 void Shader::set_ivec2(const char *name, const glm::ivec2 &value) const
 {
-  glUniform2iv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::ivec2>(name), value);
 }
 
 void Shader::set_uvec2(const char *name, const glm::uvec2 &value) const
 {
-  glUniform2uiv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::uvec2>(name), value);
 }
 
 void Shader::set_vec3(const char *name, const glm::vec3 &value) const
 {
-  glUniform3fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::vec3>(name), value);
 }
 
 void Shader::set_ivec3(const char *name, const glm::ivec3 &value) const
 {
-  glUniform3iv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::ivec3>(name), value);
 }
 
 void Shader::set_uvec3(const char *name, const glm::uvec3 &value) const
 {
-  glUniform3uiv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::uvec3>(name), value);
 }
 
 void Shader::set_vec4(const char *name, const glm::vec4 &value) const
 {
-  glUniform4fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::vec4>(name), value);
 }
 
 void Shader::set_ivec4(const char *name, const glm::ivec4 &value) const
 {
-  glUniform4iv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::ivec4>(name), value);
 }
 
 void Shader::set_uvec4(const char *name, const glm::uvec4 &value) const
 {
-  glUniform4uiv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+  set(get_uniform<glm::uvec4>(name), value);
 }
 
 void Shader::set_mat2(const char *name, const glm::mat2 &mat) const
 {
-  glUniformMatrix2fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                     glm::value_ptr(mat));
+  set(get_uniform<glm::mat2>(name), mat);
 }
 
 void Shader::set_mat3(const char *name, const glm::mat3 &mat) const
 {
-  glUniformMatrix3fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                     glm::value_ptr(mat));
+  set(get_uniform<glm::mat3>(name), mat);
 }
 
 void Shader::set_mat4(const char *name, const glm::mat4 &mat) const
 {
-  glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                     glm::value_ptr(mat));
+  set(get_uniform<glm::mat4>(name), mat);
 }
 
 void Shader::set_mat2x3(const char *name, const glm::mat2x3 &mat) const
 {
-  glUniformMatrix2x3fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat2x3>(name), mat);
 }
 
 void Shader::set_mat3x2(const char *name, const glm::mat3x2 &mat) const
 {
-  glUniformMatrix3x2fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat3x2>(name), mat);
 }
 
 void Shader::set_mat2x4(const char *name, const glm::mat2x4 &mat) const
 {
-  glUniformMatrix2x4fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat2x4>(name), mat);
 }
 
 void Shader::set_mat4x2(const char *name, const glm::mat4x2 &mat) const
 {
-  glUniformMatrix4x2fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat4x2>(name), mat);
 }
 
 void Shader::set_mat3x4(const char *name, const glm::mat3x4 &mat) const
 {
-  glUniformMatrix3x4fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat3x4>(name), mat);
 }
 
 void Shader::set_mat4x3(const char *name, const glm::mat4x3 &mat) const
 {
-  glUniformMatrix4x3fv(glGetUniformLocation(program, name), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  set(get_uniform<glm::mat4x3>(name), mat);
+}
+
+void ShaderPermutations::create(const std::filesystem::path &vertexPath,
+                                const std::filesystem::path &fragmentPath,
+                                const ShaderDefines &baseDefines)
+{
+  this->vertexPath = vertexPath;
+  this->fragmentPath = fragmentPath;
+  this->baseDefines = baseDefines;
+  variants.clear();
+}
+
+void ShaderPermutations::create(const std::filesystem::path &computePath,
+                                const ShaderDefines &baseDefines)
+{
+  create(computePath, {}, baseDefines);
+}
+
+ShaderFeatures ShaderPermutations::sorted(ShaderFeatures features)
+{
+  std::sort(features.begin(), features.end());
+  return features;
+}
+
+ShaderDefines
+ShaderPermutations::defines_for(const ShaderFeatures &features) const
+{
+  ShaderDefines defines = baseDefines;
+  defines.insert(defines.end(), features.begin(), features.end());
+  return defines;
+}
+
+void ShaderPermutations::prepare(ShaderBatch &batch,
+                                 const ShaderFeatures &features)
+{
+  auto [it, inserted] = variants.try_emplace(sorted(features));
+  if (!inserted)
+    return;
+
+  if (fragmentPath.empty())
+    batch.add(it->second, vertexPath, defines_for(it->first));
+  else
+    batch.add(it->second, vertexPath, fragmentPath, defines_for(it->first));
+}
+
+const Shader &ShaderPermutations::get(const ShaderFeatures &features)
+{
+  ShaderFeatures key = sorted(features);
+  auto it = variants.find(key);
+  if (it != variants.end())
+    return it->second;
+
+  // first use. This stalls for a compile (or a binary cache load), so
+  // variants known up front should go through prepare()
+  ShaderBatch batch;
+  prepare(batch, key);
+  batch.finish();
+  return variants.find(key)->second;
 }
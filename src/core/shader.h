@@ -1,6 +1,8 @@
 #pragma once
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <glm/ext/matrix_float2x2.hpp>
 #include <glm/ext/matrix_float2x3.hpp>
@@ -25,8 +27,64 @@
 #include <string>
 #include <gldoc.hpp>
 #include <filesystem>
+#include <map>
+#include <memory>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// injected as `#define NAME VALUE` right after the #version line. Lets c++
+// hand compile-time constants (grid sizes, workgroup sizes, limits) to glsl
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+// handle to a uniform location resolved once from the program's reflection
+// table. The type parameter is the c++ type of the uniform, so hot paths can
+// set uniforms without a string lookup and without picking the wrong setter
+template <typename T> struct UniformHandle
+{
+  int location = -1;
+
+  bool is_valid() const { return location != -1; }
+};
+
+// flat open addressing hash table from resource name to an integer
+// (uniform location or buffer binding). Filled once at link time
+class ProgramResourceTable
+{
+private:
+  struct Slot
+  {
+    std::string name;
+    std::uint32_t hash = 0;
+    int value = -1;
+    bool occupied = false;
+  };
+  std::vector<Slot> slots; // size is a power of 2
+  std::size_t count = 0;
+
+  static std::uint32_t hash_name(std::string_view name);
+
+public:
+  void reserve(std::size_t resourceCount);
+  void insert(std::string_view name, int value);
+  // returns -1 when name is not present
+  int find(std::string_view name) const;
+  std::size_t size() const { return count; }
+};
+
+// active resources of a linked program, enumerated with the program
+// interface query api
+struct ProgramReflection
+{
+  ProgramResourceTable uniforms;      // name -> location
+  ProgramResourceTable uniformBlocks; // name -> buffer binding
+  ProgramResourceTable storageBlocks; // name -> buffer binding
+
+  // names already reported as missing, so each is only warned about once
+  std::unordered_set<std::string> warnedNames;
+};
 
 // do not call the construtor in static duration haha
 // will segfault before main
@@ -34,23 +92,86 @@ class Shader
 {
 private:
   void compile_shader(const char *code, unsigned int type,
-                      unsigned int &shaderID,
-                      const std::filesystem::path &filePath);
+                      unsigned int &shaderID);
   void check_compile_errors(unsigned int program, const std::string &type,
                             const std::filesystem::path &filePath);
 
-  std::string read_file_into_string(const std::filesystem::path &filePath);
+  // reads a shader source, resolving `#include "file"` (relative to the
+  // including file, each file included once) and injecting defines. Every
+  // file gets its own #line source string number, in the order they are
+  // appended to sourceFiles
+  std::string read_file_into_string(
+      const std::filesystem::path &filePath, const ShaderDefines &defines = {},
+      std::vector<std::filesystem::path> *sourceFiles = nullptr);
+  void append_source_file(const std::filesystem::path &filePath,
+                          std::string &out,
+                          std::vector<std::filesystem::path> &sourceFiles);
+
+  friend class ShaderBatch;
+
+  void reflect();
+  int find_uniform_location(const char *name) const;
+
+  // shared so copies of a Shader don't copy the tables
+  std::shared_ptr<ProgramReflection> reflection;
+
+  static void upload(int location, bool value);
+  static void upload(int location, int value);
+  static void upload(int location, unsigned int value);
+  static void upload(int location, float value);
+  static void upload(int location, const glm::vec2 &value);
+  static void upload(int location, const glm::ivec2 &value);
+  static void upload(int location, const glm::uvec2 &value);
+  static void upload(int location, const glm::vec3 &value);
+  static void upload(int location, const glm::ivec3 &value);
+  static void upload(int location, const glm::uvec3 &value);
+  static void upload(int location, const glm::vec4 &value);
+  static void upload(int location, const glm::ivec4 &value);
+  static void upload(int location, const glm::uvec4 &value);
+  static void upload(int location, const glm::mat2 &mat);
+  static void upload(int location, const glm::mat3 &mat);
+  static void upload(int location, const glm::mat4 &mat);
+  static void upload(int location, const glm::mat2x3 &mat);
+  static void upload(int location, const glm::mat3x2 &mat);
+  static void upload(int location, const glm::mat2x4 &mat);
+  static void upload(int location, const glm::mat4x2 &mat);
+  static void upload(int location, const glm::mat3x4 &mat);
+  static void upload(int location, const glm::mat4x3 &mat);
 
 public:
   unsigned int program;
 
   Shader() : program(0) {}
+  // these build synchronously. Use ShaderBatch to build several at once
   Shader(const std::filesystem::path &vertexPath,
-         const std::filesystem::path &fragmentPath);
-  Shader(const std::filesystem::path &computePath);
+         const std::filesystem::path &fragmentPath,
+         const ShaderDefines &defines = {});
+  Shader(const std::filesystem::path &computePath,
+         const ShaderDefines &defines = {});
 
   void use() const;
-  // Uniform setters
+
+  // print how many programs were compiled vs loaded from the binary cache
+  static void print_build_stats();
+
+  // resolve a uniform once, then set it by handle in hot paths. Warns once if
+  // the uniform is not active in the program
+  template <typename T> UniformHandle<T> get_uniform(const char *name) const
+  {
+    return {find_uniform_location(name)};
+  }
+  template <typename T>
+  void set(UniformHandle<T> handle, const T &value) const
+  {
+    if (handle.location != -1)
+      upload(handle.location, value);
+  }
+
+  // buffer binding of a uniform/storage block, -1 if not active
+  int get_uniform_block_binding(const char *name) const;
+  int get_storage_block_binding(const char *name) const;
+
+  // Uniform setters. These look the name up in the reflection table
   void set_bool(const char *name, bool value) const;
   void set_int(const char *name, int value) const;
   void set_uint(const char *name, unsigned int value) const;
@@ -74,3 +195,82 @@ public:
   void set_mat3x4(const char *name, const glm::mat3x4 &mat) const;
   void set_mat4x3(const char *name, const glm::mat4x3 &mat) const;
 };
+
+// builds several programs together. submit() issues every compile and link
+// without querying any status, so with GL_KHR_parallel_shader_compile the
+// driver compiles on its own threads while the caller does other work (model
+// loading etc). finish() then waits, checks errors and reports per program
+// times. Target shaders must outlive the batch.
+class ShaderBatch
+{
+private:
+  struct Pending
+  {
+    Shader *target;
+    std::vector<std::pair<unsigned int, std::filesystem::path>> stages;
+    std::vector<std::pair<unsigned int, std::string>> sources;
+    ShaderDefines defines;
+    // per stage, files behind each #line source string number
+    std::vector<std::vector<std::filesystem::path>> sourceFiles;
+    std::vector<unsigned int> shaderIDs;
+    std::filesystem::path cachePath;
+    std::string label;
+    unsigned int program = 0;
+    bool fromCache = false;
+    bool done = false;
+    double buildMs = 0;
+  };
+  std::vector<Pending> pending;
+  std::chrono::steady_clock::time_point submitTime;
+  bool submitted = false;
+
+  void submit_one(Pending &p);
+  void complete_one(Pending &p);
+
+public:
+  void add(Shader &target, const std::filesystem::path &vertexPath,
+           const std::filesystem::path &fragmentPath,
+           const ShaderDefines &defines = {});
+  void add(Shader &target, const std::filesystem::path &computePath,
+           const ShaderDefines &defines = {});
+
+  void submit();
+  void finish();
+};
+
+// feature keys of a shader variant, e.g. {"ENABLE_SSAO", "1"}. Injected as
+// defines on top of the program's base defines
+using ShaderFeatures = ShaderDefines;
+
+// one program source specialized into variants by feature keys. Each distinct
+// set of features is compiled once, either ahead of time through a
+// ShaderBatch or lazily on first use, and cached for the lifetime of this
+// object. Lets hot shaders drop runtime branches and unroll fixed loops
+class ShaderPermutations
+{
+private:
+  std::filesystem::path vertexPath, fragmentPath; // fragment empty: compute
+  ShaderDefines baseDefines;
+  // key is sorted by name so feature order doesn't matter. std::map nodes
+  // never move, so pending batch targets stay valid
+  std::map<ShaderFeatures, Shader> variants;
+
+  static ShaderFeatures sorted(ShaderFeatures features);
+  ShaderDefines defines_for(const ShaderFeatures &features) const;
+
+public:
+  void create(const std::filesystem::path &vertexPath,
+              const std::filesystem::path &fragmentPath,
+              const ShaderDefines &baseDefines = {});
+  void create(const std::filesystem::path &computePath,
+              const ShaderDefines &baseDefines = {});
+
+  // queue a variant into a batch so it is ready before first use. Does
+  // nothing if the variant already exists
+  void prepare(ShaderBatch &batch, const ShaderFeatures &features);
+
+  // returns the variant, compiling it synchronously on first use
+  const Shader &get(const ShaderFeatures &features);
+
+  std::size_t variant_count() const { return variants.size(); }
+};
@@ -0,0 +1,364 @@
+#include "texture_compress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+using TextureCompress::Format;
+
+// 4x4 texels expanded to rgba, edges clamped
+struct Block
+{
+  unsigned char texels[16][4];
+};
+
+void load_block(const unsigned char *texels, int width, int height,
+                int numChannels, int blockX, int blockY, Block &block)
+{
+  for (int y = 0; y < 4; ++y)
+  {
+    for (int x = 0; x < 4; ++x)
+    {
+      int sx = std::min(blockX * 4 + x, width - 1);
+      int sy = std::min(blockY * 4 + y, height - 1);
+      const unsigned char *src =
+          texels + (std::size_t(sy) * width + sx) * numChannels;
+      unsigned char *dst = block.texels[y * 4 + x];
+      dst[0] = src[0];
+      dst[1] = numChannels == 1 ? src[0] : src[1];
+      dst[2] = numChannels == 1 ? src[0] : numChannels == 2 ? 0 : src[2];
+      dst[3] = numChannels == 4 ? src[3] : 255;
+    }
+  }
+}
+
+// direction of largest variance over the first N channels, by power
+// iteration on the covariance matrix
+template <int N> void principal_axis(const Block &block, float axis[N])
+{
+  float mean[N] = {};
+  for (const auto &texel : block.texels)
+    for (int c = 0; c < N; ++c)
+      mean[c] += texel[c] / 16.0f;
+
+  float covariance[N][N] = {};
+  for (const auto &texel : block.texels)
+    for (int i = 0; i < N; ++i)
+      for (int j = 0; j < N; ++j)
+        covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+
+  for (int c = 0; c < N; ++c)
+    axis[c] = 1.0f;
+  for (int iteration = 0; iteration < 8; ++iteration)
+  {
+    float next[N] = {};
+    float length = 0.0f;
+    for (int i = 0; i < N; ++i)
+    {
+      for (int j = 0; j < N; ++j)
+        next[i] += covariance[i][j] * axis[j];
+      length = std::max(length, std::abs(next[i]));
+    }
+    if (length <= 0.0f)
+      return; // flat block, any axis works
+    for (int c = 0; c < N; ++c)
+      axis[c] = next[c] / length;
+  }
+}
+
+// texels with the smallest and largest projection on the principal axis
+template <int N>
+void find_endpoints(const Block &block, int &minTexel, int &maxTexel)
+{
+  float axis[N];
+  principal_axis<N>(block, axis);
+  float minProjection = 1e30f, maxProjection = -1e30f;
+  minTexel = maxTexel = 0;
+  for (int i = 0; i < 16; ++i)
+  {
+    float projection = 0.0f;
+    for (int c = 0; c < N; ++c)
+      projection += block.texels[i][c] * axis[c];
+    if (projection < minProjection)
+    {
+      minProjection = projection;
+      minTexel = i;
+    }
+    if (projection > maxProjection)
+    {
+      maxProjection = projection;
+      maxTexel = i;
+    }
+  }
+}
+
+int distance_squared(const unsigned char *a, const int *b, int channels)
+{
+  int sum = 0;
+  for (int c = 0; c < channels; ++c)
+    sum += (a[c] - b[c]) * (a[c] - b[c]);
+  return sum;
+}
+
+std::uint16_t to_565(const unsigned char *rgb)
+{
+  return std::uint16_t(((rgb[0] * 31 + 127) / 255) << 11 |
+                       ((rgb[1] * 63 + 127) / 255) << 5 |
+                       ((rgb[2] * 31 + 127) / 255));
+}
+
+void from_565(std::uint16_t color, int *rgb)
+{
+  int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+  rgb[0] = r << 3 | r >> 2;
+  rgb[1] = g << 2 | g >> 4;
+  rgb[2] = b << 3 | b >> 2;
+}
+
+void write_le16(unsigned char *out, std::uint16_t value)
+{
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+// bc1 color block, always the 4 color mode so it also works inside bc3
+void encode_color_block(const Block &block, unsigned char *out)
+{
+  int minTexel, maxTexel;
+  find_endpoints<3>(block, minTexel, maxTexel);
+  std::uint16_t color0 = to_565(block.texels[maxTexel]);
+  std::uint16_t color1 = to_565(block.texels[minTexel]);
+  if (color0 < color1)
+    std::swap(color0, color1);
+
+  std::uint32_t indices = 0;
+  if (color0 != color1)
+  {
+    int palette[4][3];
+    from_565(color0, palette[0]);
+    from_565(color1, palette[1]);
+    for (int c = 0; c < 3; ++c)
+    {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+      int best = 0, bestDistance = 1 << 30;
+      for (int p = 0; p < 4; ++p)
+      {
+        int distance = distance_squared(block.texels[i], palette[p], 3);
+        if (distance < bestDistance)
+        {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      indices |= std::uint32_t(best) << (i * 2);
+    }
+  }
+  // equal endpoints: every index 0 picks color0
+
+  write_le16(out, color0);
+  write_le16(out + 2, color1);
+  std::memcpy(out + 4, &indices, 4); // little endian
+}
+
+// bc4 block of one channel, 8 value mode
+void encode_channel_block(const Block &block, int channel, unsigned char *out)
+{
+  int maxValue = 0, minValue = 255;
+  for (const auto &texel : block.texels)
+  {
+    maxValue = std::max<int>(maxValue, texel[channel]);
+    minValue = std::min<int>(minValue, texel[channel]);
+  }
+  out[0] = static_cast<unsigned char>(maxValue);
+  out[1] = static_cast<unsigned char>(minValue);
+
+  std::uint64_t indices = 0;
+  if (maxValue != minValue)
+  {
+    int palette[8] = {maxValue, minValue};
+    for (int i = 2; i < 8; ++i)
+      palette[i] = ((8 - i) * maxValue + (i - 1) * minValue) / 7;
+    for (int i = 0; i < 16; ++i)
+    {
+      int best = 0, bestDistance = 1 << 30;
+      for (int p = 0; p < 8; ++p)
+      {
+        int distance = std::abs(block.texels[i][channel] - palette[p]);
+        if (distance < bestDistance)
+        {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      indices |= std::uint64_t(best) << (i * 3);
+    }
+  }
+  for (int i = 0; i < 6; ++i)
+    out[2 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+struct BitWriter
+{
+  unsigned char *out;
+  int position = 0;
+
+  void write(std::uint32_t value, int bits)
+  {
+    for (int i = 0; i < bits; ++i, ++position)
+    {
+      if ((value >> i) & 1)
+        out[position >> 3] |= 1 << (position & 7);
+    }
+  }
+};
+
+// bc7 mode 6: one subset, rgba 7 bit endpoints with a shared low bit each,
+// 4 bit indices
+void encode_bc7_block(const Block &block, unsigned char *out)
+{
+  static constexpr int weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                      34, 38, 43, 47, 51, 55, 60, 64};
+
+  int minTexel, maxTexel;
+  find_endpoints<4>(block, minTexel, maxTexel);
+  const unsigned char *ends[2] = {block.texels[minTexel],
+                                  block.texels[maxTexel]};
+
+  // per endpoint, pick the low bit that lands closest
+  int quantized[2][4], pBits[2], expanded[2][4];
+  for (int e = 0; e < 2; ++e)
+  {
+    int bestError = 1 << 30;
+    for (int p = 0; p < 2; ++p)
+    {
+      int q[4], error = 0;
+      for (int c = 0; c < 4; ++c)
+      {
+        q[c] = std::clamp((ends[e][c] - p + 1) / 2, 0, 127);
+        int value = q[c] << 1 | p;
+        error += (value - ends[e][c]) * (value - ends[e][c]);
+      }
+      if (error < bestError)
+      {
+        bestError = error;
+        pBits[e] = p;
+        for (int c = 0; c < 4; ++c)
+        {
+          quantized[e][c] = q[c];
+          expanded[e][c] = q[c] << 1 | p;
+        }
+      }
+    }
+  }
+
+  int palette[16][4];
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 4; ++c)
+      palette[i][c] = ((64 - weights[i]) * expanded[0][c] +
+                       weights[i] * expanded[1][c] + 32) >> 6;
+
+  int indices[16];
+  for (int i = 0; i < 16; ++i)
+  {
+    int best = 0, bestDistance = 1 << 30;
+    for (int p = 0; p < 16; ++p)
+    {
+      int distance = distance_squared(block.texels[i], palette[p], 4);
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = p;
+      }
+    }
+    indices[i] = best;
+  }
+
+  // the first index is stored without its top bit, it must be below 8
+  if (indices[0] >= 8)
+  {
+    for (int &index : indices)
+      index = 15 - index;
+    std::swap(quantized[0], quantized[1]);
+    std::swap(pBits[0], pBits[1]);
+  }
+
+  std::memset(out, 0, 16);
+  BitWriter writer{out};
+  writer.write(1u << 6, 7); // mode 6
+  for (int c = 0; c < 4; ++c)
+  {
+    writer.write(quantized[0][c], 7);
+    writer.write(quantized[1][c], 7);
+  }
+  writer.write(pBits[0], 1);
+  writer.write(pBits[1], 1);
+  writer.write(indices[0], 3);
+  for (int i = 1; i < 16; ++i)
+    writer.write(indices[i], 4);
+}
+} // namespace
+
+namespace TextureCompress
+{
+
+Format choose_format(Role role, int numChannels, bool hasAlpha, bool s3tc)
+{
+  switch (role)
+  {
+  case Role::COLOR:
+    if (numChannels < 3)
+      return Format::NONE;
+    if (!s3tc)
+      return Format::BC7;
+    return hasAlpha ? Format::BC3 : Format::BC1;
+  case Role::NORMAL:
+    return numChannels >= 2 ? Format::BC5 : Format::NONE;
+  case Role::DATA:
+    return Format::BC7;
+  }
+  return Format::NONE;
+}
+
+void compress(Format format, const unsigned char *texels, int width,
+              int height, int numChannels, unsigned char *destination)
+{
+  const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  const std::size_t blockSize = block_bytes(format);
+  Block block;
+  for (int by = 0; by < blocksY; ++by)
+  {
+    for (int bx = 0; bx < blocksX; ++bx)
+    {
+      load_block(texels, width, height, numChannels, bx, by, block);
+      unsigned char *out =
+          destination + (std::size_t(by) * blocksX + bx) * blockSize;
+      switch (format)
+      {
+      case Format::BC1:
+        encode_color_block(block, out);
+        break;
+      case Format::BC3:
+        encode_channel_block(block, 3, out);
+        encode_color_block(block, out + 8);
+        break;
+      case Format::BC5:
+        encode_channel_block(block, 0, out);
+        encode_channel_block(block, 1, out + 8);
+        break;
+      case Format::BC7:
+        encode_bc7_block(block, out);
+        break;
+      case Format::NONE:
+        break;
+      }
+    }
+  }
+}
+
+} // namespace TextureCompress
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// cpu block compression of 8 bit images into the BCn formats GL samples
+// directly. Pure cpu, safe to run on worker threads. Encoders are single
+// pass (principal axis endpoints, nearest palette index), fast enough for
+// import and cached afterwards
+namespace TextureCompress
+{
+// stored in the model cache, don't reorder
+enum class Format : std::int32_t
+{
+  NONE = 0, // raw 8 bit texels
+  BC1 = 1,  // rgb, 8 bytes per 4x4 block
+  BC3 = 2,  // rgba, bc1 color + bc4 alpha, 16 bytes per block
+  BC5 = 3,  // rg, two bc4 channels, for normal maps
+  BC7 = 4,  // rgba, mode 6 only, 16 bytes per block
+};
+
+// what a texture is used for, decides the format
+enum class Role
+{
+  COLOR,  // srgb albedo
+  NORMAL, // tangent space xy
+  DATA,   // linear masks: specular, roughness etc
+};
+
+inline std::size_t block_bytes(Format format)
+{
+  return format == Format::BC1 ? 8 : 16;
+}
+
+// bytes of one width x height level
+inline std::size_t level_size(Format format, int width, int height,
+                              int numChannels)
+{
+  if (format == Format::NONE)
+    return std::size_t(width) * height * numChannels;
+  std::size_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  return blocksX * blocksY * block_bytes(format);
+}
+
+// hasAlpha: some texel has alpha below 255. s3tc: whether the GL supports
+// BC1/BC3 (EXT_texture_compression_s3tc), BC5/BC7 are core
+Format choose_format(Role role, int numChannels, bool hasAlpha, bool s3tc);
+
+// compress one level. 1 channel images are grey, 2 channel ones rg.
+// destination must hold level_size(format, ...)
+void compress(Format format, const unsigned char *texels, int width,
+              int height, int numChannels, unsigned char *destination);
+
+} // namespace TextureCompress
@@ -0,0 +1,340 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+std::tuple<int, int> get_texture_formats(int numChannels,
+                                         bool isLinearColorSpace)
+{
+  auto format = GL_RGB;
+  auto internalFormat = GL_RGB;
+
+  if (numChannels == 1) // always assumed linear color space
+  {
+    format = GL_RED;
+    internalFormat = GL_RED;
+  }
+  else if (numChannels == 2) // always linear, e.g. normal map xy
+  {
+    format = GL_RG;
+    internalFormat = GL_RG;
+  }
+  else if (numChannels == 3)
+  {
+    format = GL_RGB;
+    internalFormat = isLinearColorSpace ? GL_RGB : GL_SRGB;
+  }
+  else if (numChannels == 4)
+  {
+    format = GL_RGBA;
+    internalFormat = isLinearColorSpace ? GL_RGBA : GL_SRGB_ALPHA;
+  }
+  return {format, internalFormat};
+}
+
+// BC1/BC3 formats come from EXT_texture_compression_s3tc and
+// EXT_texture_sRGB, which the core headers don't have
+constexpr auto GL_COMPRESSED_RGB_S3TC_DXT1_EXT{0x83F0};
+constexpr auto GL_COMPRESSED_RGBA_S3TC_DXT5_EXT{0x83F3};
+constexpr auto GL_COMPRESSED_SRGB_S3TC_DXT1_EXT{0x8C4C};
+constexpr auto GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT{0x8C4F};
+
+int get_compressed_format(TextureCompress::Format format,
+                          bool isLinearColorSpace)
+{
+  using TextureCompress::Format;
+  switch (format)
+  {
+  case Format::BC1:
+    return isLinearColorSpace ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                              : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+  case Format::BC3:
+    return isLinearColorSpace ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                              : GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+  case Format::BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  case Format::BC7:
+    return isLinearColorSpace ? GL_COMPRESSED_RGBA_BPTC_UNORM
+                              : GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+  case Format::NONE:
+    break;
+  }
+  return 0;
+}
+
+void TextureStreamer::create(std::size_t frameBudgetBytes,
+                             std::size_t ringSize)
+{
+  frameBudget = frameBudgetBytes;
+  ring.resize(ringSize);
+  for (Slot &slot : ring)
+    glGenBuffers(1, &slot.pbo);
+}
+
+void TextureStreamer::destroy()
+{
+  for (Slot &slot : ring)
+  {
+    if (slot.fence)
+      glDeleteSync(slot.fence);
+    glDeleteBuffers(1, &slot.pbo);
+  }
+  ring.clear();
+  pending.clear();
+  std::lock_guard lock(mutex);
+  incoming.clear();
+}
+
+unsigned int TextureStreamer::create_placeholder(bool isLinear)
+{
+  static constexpr unsigned char grey[4] = {128, 128, 128, 255};
+
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  // only level 0 until the first real level lands
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  auto [format, internalFormat] = get_texture_formats(4, isLinear);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, 1, 1, 0, format,
+               GL_UNSIGNED_BYTE, grey);
+  return texture;
+}
+
+void TextureStreamer::submit(unsigned int texture, TextureData data)
+{
+  if (data.levels.empty())
+    return;
+  const int level = static_cast<int>(data.levels.size()) - 1;
+  std::lock_guard lock(mutex);
+  incoming.push_back({texture, std::move(data), level});
+}
+
+void TextureStreamer::retarget(unsigned int texture, unsigned int replacement)
+{
+  for (Pending &pendingTexture : pending)
+    if (pendingTexture.texture == texture)
+      pendingTexture.texture = replacement;
+  std::lock_guard lock(mutex);
+  for (Pending &incomingTexture : incoming)
+    if (incomingTexture.texture == texture)
+      incomingTexture.texture = replacement;
+}
+
+std::size_t TextureStreamer::get_pending_count()
+{
+  std::lock_guard lock(mutex);
+  return pending.size() + incoming.size();
+}
+
+// rows a strip advances by, compressed levels go in whole block rows
+static int row_unit(TextureCompress::Format format)
+{
+  return format == TextureCompress::Format::NONE ? 1 : 4;
+}
+
+void TextureStreamer::update()
+{
+  {
+    std::lock_guard lock(mutex);
+    for (Pending &texture : incoming)
+      pending.push_back(std::move(texture));
+    incoming.clear();
+  }
+  if (pending.empty())
+    return;
+
+  // the gpu may still be reading this pbo from ringSize frames ago. Rather
+  // than wait, skip streaming for a frame
+  Slot &slot = ring[nextSlot];
+  if (slot.fence)
+  {
+    if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+      return;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+  }
+
+  // plan this frame's strips, smallest pending level first. Always make
+  // some progress, even if one row is over budget
+  std::vector<Strip> strips;
+  std::size_t used = 0;
+  while (true)
+  {
+    Pending *next = nullptr;
+    std::size_t nextSize = 0;
+    for (Pending &texture : pending)
+    {
+      if (texture.level < 0)
+        continue;
+      const TextureData &data = texture.data;
+      std::size_t size = TextureCompress::level_size(
+          data.format, std::max(1, data.width >> texture.level),
+          std::max(1, data.height >> texture.level), data.numChannels);
+      if (!next || size < nextSize)
+      {
+        next = &texture;
+        nextSize = size;
+      }
+    }
+    if (!next)
+      break;
+
+    const TextureData &data = next->data;
+    const int width = std::max(1, data.width >> next->level);
+    const int height = std::max(1, data.height >> next->level);
+    const int unit = row_unit(data.format);
+    const std::size_t unitBytes = TextureCompress::level_size(
+        data.format, width, unit, data.numChannels);
+
+    int rows = static_cast<int>((frameBudget - std::min(used, frameBudget)) /
+                                unitBytes) *
+               unit;
+    if (rows == 0)
+    {
+      if (!strips.empty())
+        break;
+      rows = unit;
+    }
+    rows = std::min(rows, height - next->row);
+
+    strips.push_back({next, next->level, next->row, rows, used});
+    std::size_t bytes = TextureCompress::level_size(data.format, width, rows,
+                                                    data.numChannels);
+    used += (bytes + 15) & ~std::size_t(15);
+
+    next->row += rows;
+    if (next->row >= height)
+    {
+      --next->level;
+      next->row = 0;
+    }
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+  if (slot.capacity < used)
+  {
+    slot.capacity = std::max(used, frameBudget);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, nullptr,
+                 GL_STREAM_DRAW);
+  }
+  // fenced above, so no need for the driver to synchronize
+  auto *staging = static_cast<unsigned char *>(glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, used,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+          GL_MAP_UNSYNCHRONIZED_BIT));
+  for (const Strip &strip : strips)
+  {
+    const TextureData &data = strip.texture->data;
+    const int width = std::max(1, data.width >> strip.level);
+    const std::size_t unitBytes = TextureCompress::level_size(
+        data.format, width, row_unit(data.format), data.numChannels);
+    const std::size_t skip = strip.row / row_unit(data.format) * unitBytes;
+    std::memcpy(staging + strip.offset, data.levels[strip.level] + skip,
+                TextureCompress::level_size(data.format, width, strip.rows,
+                                            data.numChannels));
+  }
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rgb rows are not 4 byte aligned
+  for (const Strip &strip : strips)
+    upload_strip(strip);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  nextSlot = (nextSlot + 1) % ring.size();
+  uploadedBytes += used;
+
+  // finished chains let go of their source memory
+  std::erase_if(pending, [](const Pending &texture)
+                { return texture.level < 0; });
+}
+
+// GL_PIXEL_UNPACK_BUFFER is bound, so data pointers are pbo offsets
+void TextureStreamer::upload_strip(const Strip &strip)
+{
+  const TextureData &data = strip.texture->data;
+  const int width = std::max(1, data.width >> strip.level);
+  const int height = std::max(1, data.height >> strip.level);
+  const bool compressed = data.format != TextureCompress::Format::NONE;
+  const int compressedFormat =
+      get_compressed_format(data.format, data.isLinear);
+  auto [format, internalFormat] =
+      get_texture_formats(data.numChannels, data.isLinear);
+  const auto *pixels = reinterpret_cast<const void *>(strip.offset);
+  const auto size = static_cast<int>(TextureCompress::level_size(
+      data.format, width, strip.rows, data.numChannels));
+
+  if (data.layer >= 0)
+  {
+    // storage exists for every level, only fill in the layer
+    glBindTexture(GL_TEXTURE_2D_ARRAY, strip.texture->texture);
+    if (compressed)
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, strip.level, 0,
+                                strip.row, data.layer, width, strip.rows, 1,
+                                compressedFormat, size, pixels);
+    else
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, strip.level, 0, strip.row,
+                      data.layer, width, strip.rows, 1, format,
+                      GL_UNSIGNED_BYTE, pixels);
+    if (strip.row + strip.rows == height && data.onLevelReady)
+      data.onLevelReady(strip.level);
+    return;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, strip.texture->texture);
+  if (strip.rows == height)
+  {
+    if (compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, strip.level, compressedFormat,
+                             width, height, 0, size, pixels);
+    else
+      glTexImage2D(GL_TEXTURE_2D, strip.level, internalFormat, width, height,
+                   0, format, GL_UNSIGNED_BYTE, pixels);
+  }
+  else
+  {
+    if (strip.row == 0)
+    {
+      // allocate the level, contents come in the strips below. Unbound, a
+      // null pointer means no data instead of offset 0
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      if (compressed)
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D, strip.level, compressedFormat, width, height, 0,
+            static_cast<int>(TextureCompress::level_size(
+                data.format, width, height, data.numChannels)),
+            nullptr);
+      else
+        glTexImage2D(GL_TEXTURE_2D, strip.level, internalFormat, width,
+                     height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring[nextSlot].pbo);
+    }
+    if (compressed)
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, strip.level, 0, strip.row,
+                                width, strip.rows, compressedFormat, size,
+                                pixels);
+    else
+      glTexSubImage2D(GL_TEXTURE_2D, strip.level, 0, strip.row, width,
+                      strip.rows, format, GL_UNSIGNED_BYTE, pixels);
+  }
+
+  if (strip.row + strip.rows < height)
+    return;
+  // level complete, sample from it. The first one also drops the
+  // placeholder, which lives in level 0 below the streamed range
+  const int lastLevel = static_cast<int>(data.levels.size()) - 1;
+  if (strip.level == lastLevel)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, lastLevel);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, strip.level);
+  if (data.onLevelReady)
+    data.onLevelReady(strip.level);
+}
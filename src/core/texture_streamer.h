@@ -0,0 +1,105 @@
+#pragma once
+
+#include "core/texture_compress.h"
+
+#include <cstddef>
+#include <functional>
+#include <gldoc.hpp>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// gl {format, internalFormat} of an uncompressed 8 bit image
+std::tuple<int, int> get_texture_formats(int numChannels,
+                                         bool isLinearColorSpace);
+// gl internal format of a block compressed image
+int get_compressed_format(TextureCompress::Format format,
+                          bool isLinearColorSpace);
+
+// mip chain ready for upload. levels point into memory kept alive by owner,
+// e.g. a decoded image or a mapped model cache. Level i is
+// max(1, width >> i) by max(1, height >> i) texels, tightly packed
+struct TextureData
+{
+  int width = 0, height = 0;
+  int numChannels = 0;
+  bool isLinear = false;
+  TextureCompress::Format format = TextureCompress::Format::NONE;
+  std::vector<const unsigned char *> levels;
+  std::shared_ptr<const void> owner;
+  // >= 0: upload into this layer of a GL_TEXTURE_2D_ARRAY with immutable
+  // storage for every level, instead of a placeholder texture
+  int layer = -1;
+  // GL thread, after each level is complete
+  std::function<void(int level)> onLevelReady;
+};
+
+// uploads textures in the background of the frame loop. A streamed texture
+// is a normal GL texture from the start, holding a 1x1 placeholder, so its
+// id can be handed out right away. Workers submit decoded mip chains, the GL
+// thread copies them through a ring of pixel buffer objects, at most
+// frameBudget bytes per frame, coarsest mips of every texture first. Each
+// finished level lowers the texture's base level, so detail sharpens in as
+// it arrives and a big level never stalls a frame: it goes up in strips.
+// Array layers are filled the same way, their owner clamps sampling to the
+// levels reported ready
+class TextureStreamer
+{
+private:
+  struct Pending
+  {
+    unsigned int texture;
+    TextureData data;
+    int level;   // being uploaded, counts down to 0, -1 when done
+    int row = 0; // rows of level done
+  };
+
+  // part of one level, staged at offset in the frame's pbo
+  struct Strip
+  {
+    Pending *texture;
+    int level, row, rows;
+    std::size_t offset;
+  };
+
+  struct Slot
+  {
+    unsigned int pbo = 0;
+    std::size_t capacity = 0;
+    GLsync fence = nullptr; // after the last uploads from the pbo
+  };
+
+  std::vector<Slot> ring;
+  std::size_t nextSlot = 0;
+  std::size_t frameBudget = 0;
+
+  std::mutex mutex; // guards incoming
+  std::vector<Pending> incoming;
+  std::vector<Pending> pending; // GL thread only
+
+  std::size_t uploadedBytes = 0;
+
+  void upload_strip(const Strip &strip);
+
+public:
+  void create(std::size_t frameBudgetBytes, std::size_t ringSize = 3);
+  void destroy();
+
+  // new texture showing a flat placeholder until data is submitted. GL
+  // thread only
+  unsigned int create_placeholder(bool isLinear);
+
+  // queue a mip chain for texture. Any thread
+  void submit(unsigned int texture, TextureData data);
+  // texture was replaced, e.g. by a grown array holding a copy of it. Send
+  // the remaining uploads to replacement instead
+  void retarget(unsigned int texture, unsigned int replacement);
+
+  // upload the next part of the queue. GL thread, once per frame
+  void update();
+
+  // textures waiting or partly uploaded. GL thread
+  std::size_t get_pending_count();
+  std::size_t get_uploaded_bytes() const { return uploadedBytes; }
+};
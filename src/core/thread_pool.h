@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// fixed size pool of worker threads for cpu heavy work (image decode,
+// texture compression etc). Tasks must never call GL, the context belongs to
+// the main thread
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable taskAvailable;
+  bool stopping = false;
+
+  void worker_loop()
+  {
+    while (true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex);
+        taskAvailable.wait(lock, [&] { return stopping || !tasks.empty(); });
+        if (tasks.empty())
+          return; // stopping and drained
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(unsigned int threadCount = default_thread_count())
+  {
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+      workers.emplace_back([this] { worker_loop(); });
+  }
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+  }
+
+  std::size_t size() const { return workers.size(); }
+
+  // run runTask(0) to runTask(taskCount - 1) on the workers and this thread,
+  // returns once all are done. Both take tasks from a shared counter, if the
+  // workers are busy, e.g. decoding textures, this thread simply does all of
+  // it. Workers that start late find nothing left and never touch runTask
+  template <typename F> void run_tasks(std::size_t taskCount, F &&runTask)
+  {
+    if (taskCount <= 1)
+    {
+      if (taskCount == 1)
+        runTask(std::size_t{0});
+      return;
+    }
+
+    struct Job
+    {
+      std::atomic<std::size_t> next{0}, done{0};
+    };
+    auto job = std::make_shared<Job>();
+    auto work = [job, taskCount, &runTask]
+    {
+      for (std::size_t task; (task = job->next++) < taskCount;)
+      {
+        runTask(task);
+        if (++job->done == taskCount)
+          job->done.notify_all();
+      }
+    };
+
+    const std::size_t helpers = std::min(size(), taskCount - 1);
+    for (std::size_t i = 0; i < helpers; ++i)
+      submit(work);
+    work();
+    for (std::size_t done; (done = job->done) != taskCount;)
+      job->done.wait(done);
+  }
+
+  // leave one core for the main thread, which keeps uploading to GL
+  static unsigned int default_thread_count()
+  {
+    unsigned int cores = std::thread::hardware_concurrency();
+    return std::max(1u, cores > 1 ? cores - 1 : 1u);
+  }
+
+  // process wide pool, created on first use
+  static ThreadPool &shared()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+};
+
+// multi producer, single consumer queue of finished work. Workers push
+// results as they complete, the consuming thread pops them in completion
+// order and blocks while none are ready
+template <typename T> class CompletionQueue
+{
+private:
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable itemAvailable;
+
+public:
+  void push(T item)
+  {
+    {
+      std::lock_guard lock(mutex);
+      items.push_back(std::move(item));
+    }
+    itemAvailable.notify_one();
+  }
+
+  T pop()
+  {
+    std::unique_lock lock(mutex);
+    itemAvailable.wait(lock, [&] { return !items.empty(); });
+    T item = std::move(items.front());
+    items.pop_front();
+    return item;
+  }
+};
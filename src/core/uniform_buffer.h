@@ -0,0 +1,52 @@
+#pragma once
+
+#include <gldoc.hpp>
+
+// fixed binding points for uniform blocks. These must match the
+// `layout(std140, binding = N)` qualifiers in the shaders
+namespace UniformBinding
+{
+constexpr unsigned int FRAME = 0;       // camera matrices, screen, near/far
+constexpr unsigned int SSAO_KERNEL = 1; // static ssao sample kernel
+constexpr unsigned int SSAO_PASS = 2;
+constexpr unsigned int HDR_PASS = 3;
+} // namespace UniformBinding
+
+// fixed binding points for shader storage blocks, `layout(std430, binding = N)`
+namespace StorageBinding
+{
+constexpr unsigned int CLUSTERS = 1;
+constexpr unsigned int LIGHTS = 2;
+constexpr unsigned int DRAWS = 3; // per draw transforms of the scene
+constexpr unsigned int DRAW_COMMANDS = 4;   // indirect commands, culling
+constexpr unsigned int DRAW_VISIBILITY = 5; // last frame visibility
+constexpr unsigned int MATERIALS = 6;       // MaterialLibrary table
+} // namespace StorageBinding
+
+// uniform buffer object that holds a single T. T must follow the std140
+// layout of its glsl uniform block: vec3 padded to 16 bytes, arrays of vec4,
+// bool stored as uint etc.
+template <typename T> struct UniformBuffer
+{
+  unsigned int ubo = 0;
+
+  // allocate and bind to a fixed binding point. Shaders pick it up from
+  // there, so there is no per program setup.
+  void create(unsigned int binding, const T *initialData = nullptr)
+  {
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), initialData, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void update(const T &data) const
+  {
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void destroy() { glDeleteBuffers(1, &ubo); }
+};
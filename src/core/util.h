@@ -2,7 +2,10 @@
 #include "imgui.h"
 #include <iostream>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <ratio>
+#include <string_view>
 #include <gldoc.hpp>
 // timer to measure code execution time
 class Timer
@@ -30,3 +33,24 @@ public:
     return elapsed.count();
   }
 };
+
+// 64 bit FNV-1a. Used for cache keys, not for anything security related.
+// Pass the previous result as seed to hash several pieces of data together
+constexpr std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+inline std::uint64_t hash_bytes(const void *data, std::size_t size,
+                                std::uint64_t seed = FNV_OFFSET_BASIS)
+{
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  std::uint64_t hash = seed;
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+inline std::uint64_t hash_string(std::string_view str,
+                                 std::uint64_t seed = FNV_OFFSET_BASIS)
+{
+  return hash_bytes(str.data(), str.size(), seed);
+}
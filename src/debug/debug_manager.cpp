@@ -7,6 +7,8 @@
 #include "debug_manager.h"
 #include "camera.h"
 #include "core/core.h"
+#include "core/texture_streamer.h"
+#include "frame_pipeline.h"
 #include <iostream>
 #include <map>
 #include <string>
@@ -170,6 +172,12 @@ void draw(Camera *camera)
   ImGui::Text("Position: %.2f, %.2f, %.2f", camera->position.x,
               camera->position.y, camera->position.z);
 
+  TextureStreamer &streamer = Core::GL::get_texture_streamer();
+  if (std::size_t streaming = streamer.get_pending_count())
+    ImGui::Text("Streaming textures: %d (%d mb uploaded)",
+                static_cast<int>(streaming),
+                static_cast<int>(streamer.get_uploaded_bytes() / 1'000'000));
+
   // ImGui::PushStyleColor(ImGuiCol_Text, green);
 
   labeledFloatManager.update(Core::get_deltatime());
@@ -184,6 +192,19 @@ void draw(Camera *camera)
                                        // can cause low fps mid typing
   Core::set_targetfps(targetFps);
 
+  static int maxQueuedFrames = Core::get_max_queued_frames();
+  ImGui::SliderInt("Max queued frames", &maxQueuedFrames, 0, 4);
+  Core::set_max_queued_frames(maxQueuedFrames);
+
+  const FramePacer::Stats &pacing = Core::get_frame_pacing_stats();
+  ImGui::Text("Pacing jitter: %.3f ms, wake error %.3f ms",
+              pacing.jitterMs, pacing.wakeErrorMs);
+  ImGui::Text("CPU idle: %.0f%%, gpu wait %.2f ms",
+              pacing.idleFraction * 100.0, pacing.fenceWaitMs);
+
+  // prep one frame ahead, off for a frame of less input latency
+  ImGui::Checkbox("Pipeline frame prep", &is_frame_pipelined());
+
   // camera controls
   static bool scrollControl = true;
 
@@ -202,6 +223,9 @@ void draw(Camera *camera)
 
   // wireframe
   ImGui::Checkbox("Wireframe", &Render::is_wireframe());
+  ImGui::Checkbox("Occlusion culling", &Render::is_occlusion_culling());
+  ImGui::SliderFloat("LOD pixel error", &Render::get_lod_pixel_error(), 0.0f,
+                     8.0f);
 
   // face cull
   static bool backfaceCull = true;
@@ -250,6 +274,37 @@ void draw(Camera *camera)
   ImGui::SliderFloat("Exposure", &Render::get_hdr_exposure(), 0.1, 5);
   ImGui::SliderFloat("Gamma", &Render::get_gamma(), 1, 3);
 
+  ImGui::SeparatorText("Debug views");
+  ImGui::Checkbox("Light gizmos", &Render::Debug::is_showing_light_gizmos());
+  ImGui::BeginDisabled(!Render::Debug::is_showing_light_gizmos());
+  {
+    Render::Debug::LightGizmoOptions &gizmos =
+        Render::Debug::get_light_gizmo_options();
+    ImGui::Checkbox("Light radius", &gizmos.showRadius);
+    ImGui::Checkbox("Color by cluster light count",
+                    &gizmos.colorByClusterCount);
+  }
+  ImGui::EndDisabled();
+
+  ImGui::Checkbox("Cluster boxes",
+                  &Render::Compute::is_showing_cluster_aabbs());
+  ImGui::BeginDisabled(!Render::Compute::is_showing_cluster_aabbs());
+  {
+    Render::Compute::ClusterAABBOptions &boxes =
+        Render::Compute::get_cluster_aabb_options();
+    const unsigned int minSlice = 0;
+    const unsigned int maxSlice =
+        Render::Compute::get_cluster_slice_count() - 1;
+    boxes.lastSlice = std::min(boxes.lastSlice, maxSlice);
+    ImGui::SliderScalar("First slice", ImGuiDataType_U32, &boxes.firstSlice,
+                        &minSlice, &maxSlice);
+    ImGui::SliderScalar("Last slice", ImGuiDataType_U32, &boxes.lastSlice,
+                        &minSlice, &maxSlice);
+    boxes.lastSlice = std::max(boxes.lastSlice, boxes.firstSlice);
+    ImGui::Checkbox("Non-empty clusters only", &boxes.nonEmptyOnly);
+  }
+  ImGui::EndDisabled();
+
   ImGui::End();
 
   // ImGui::ShowDemoWindow();
@@ -0,0 +1,106 @@
+#include "frame_pipeline.h"
+#include "core/util.h"
+
+#include <utility>
+
+bool &is_frame_pipelined()
+{
+  static bool pipelined = true;
+  return pipelined;
+}
+
+void FramePipeline::create(PrepareFunction prepare)
+{
+  this->prepare = std::move(prepare);
+  stopping = false;
+  worker = std::thread([this] { worker_loop(); });
+}
+
+void FramePipeline::destroy()
+{
+  if (!worker.joinable())
+    return;
+  {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return !preparing; });
+    stopping = true;
+  }
+  changed.notify_all();
+  worker.join();
+  prepared = false;
+}
+
+void FramePipeline::run_prepare(FramePacket &packet)
+{
+  Timer timer;
+  timer.start();
+  prepare(packet);
+  packet.prepMs = timer.stop_and_get_time_ms();
+}
+
+void FramePipeline::worker_loop()
+{
+  while (true)
+  {
+    FramePacket *packet;
+    {
+      std::unique_lock lock(mutex);
+      changed.wait(lock, [&] { return stopping || preparing; });
+      if (stopping)
+        return;
+      packet = preparing;
+    }
+    run_prepare(*packet);
+    {
+      std::lock_guard lock(mutex);
+      preparing = nullptr;
+      prepared = true;
+    }
+    changed.notify_all();
+  }
+}
+
+const FramePacket &FramePipeline::advance(const Camera &camera, int width,
+                                          int height)
+{
+  Timer timer;
+  timer.start();
+  bool ready;
+  {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return !preparing; });
+    ready = prepared;
+    prepared = false;
+  }
+  waitMs = timer.stop_and_get_time_ms();
+
+  // every prepared packet is submitted once, also when pipelining was just
+  // turned off. The first frame, or running in order, builds it here
+  if (ready)
+  {
+    submitIndex ^= 1;
+  }
+  else
+  {
+    FramePacket &packet = packets[submitIndex];
+    packet.camera = camera;
+    packet.width = width;
+    packet.height = height;
+    run_prepare(packet);
+  }
+
+  if (is_frame_pipelined())
+  {
+    // GL is done with the other packet, it was submitted last frame
+    FramePacket &next = packets[submitIndex ^ 1];
+    next.camera = camera;
+    next.width = width;
+    next.height = height;
+    {
+      std::lock_guard lock(mutex);
+      preparing = &next;
+    }
+    changed.notify_all();
+  }
+  return packets[submitIndex];
+}
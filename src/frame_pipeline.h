@@ -0,0 +1,71 @@
+#pragma once
+
+#include "camera.h"
+#include "render_manager.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// cpu side results of one frame, everything the GL thread needs to submit it
+struct FramePacket
+{
+  // input, snapshotted on the main thread. Prep updates the matrixes
+  Camera camera;
+  int width = 0, height = 0;
+
+  std::vector<PointLight> visibleLights;
+  bool drawsChanged = false; // draws is only rebuilt when set
+  Render::SceneDraws draws;
+
+  double lightCullMs = 0;
+  double prepMs = 0;
+};
+
+// runs the cpu prep of frame N + 1 on its own thread while the main thread
+// submits frame N to GL, so a frame costs max(prep, submit) instead of the
+// sum. Two packets are alternated, prep writes one while GL reads the other.
+// Input and the GL context stay on the main thread, it snapshots the camera
+// into the packet and only consumes finished packets. Pipelining shows the
+// camera one frame late, see is_frame_pipelined()
+class FramePipeline
+{
+public:
+  // fills the packet from its camera. Must not call GL
+  using PrepareFunction = std::function<void(FramePacket &)>;
+
+private:
+  FramePacket packets[2];
+  unsigned int submitIndex = 0; // the packet GL reads
+  PrepareFunction prepare;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable changed;
+  FramePacket *preparing = nullptr; // handed to the worker, null when idle
+  bool prepared = false; // the other packet is done and not submitted yet
+  bool stopping = false;
+
+  double waitMs = 0;
+
+  void run_prepare(FramePacket &packet);
+  void worker_loop();
+
+public:
+  void create(PrepareFunction prepare);
+  // waits for the prep in flight
+  void destroy();
+
+  // returns the packet to submit this frame, valid until the next call. When
+  // pipelined that is the one started last call, waiting for it if needed, and
+  // prep of the next starts from camera. Otherwise it is built from camera
+  // right here
+  const FramePacket &advance(const Camera &camera, int width, int height);
+
+  // how long the last advance() blocked on prep
+  double get_wait_ms() const { return waitMs; }
+};
+
+// prep one frame ahead on the pipeline thread, off runs everything in order
+bool &is_frame_pipelined();
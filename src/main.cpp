@@ -8,6 +8,8 @@
 #include "debug/debug_manager.h"
 #include "core/core.h"
 #include "core/shader.h"
+#include "core/uniform_buffer.h"
+#include "frame_pipeline.h"
 #include "render_manager.h"
 #include <GLFW/glfw3.h>
 #include <glm/ext/matrix_float4x4.hpp>
@@ -31,7 +33,6 @@
 void process_input();
 
 std::vector<PointLight> lightList;
-std::vector<Transform> lightPositions;
 std::vector<glm::mat4> lightMats;
 unsigned int lightSSBO;
 
@@ -52,15 +53,18 @@ int main(int argc, char *argv[])
   // init globals
 
   DebugGui::init();
-  Render::init();
-
-  Shader quadShader(ASSETS_PATH "quad.vert", ASSETS_PATH "quad.frag");
+  Render::init(); // shaders compile in the background from here
 
   Timer modelTimer;
   modelTimer.start();
   Model myModel = Core::GL::load_gltf(ASSETS_PATH "models/sponza_rotated.glb");
   modelTimer.stop_and_print();
 
+  Render::finish_init();
+  Render::upload_scene_draws(myModel);
+  Shader quadShader(ASSETS_PATH "quad.vert", ASSETS_PATH "quad.frag");
+  Shader::print_build_stats();
+
   // Model myModel = Core::GL::load_gltf(ASSETS_PATH
   // "models/sponza_low_res.glb");
   // Model myModel = Core::GL::load_gltf(ASSETS_PATH "models/untitled.glb");
@@ -118,11 +122,6 @@ int main(int argc, char *argv[])
       light.intensity = 1.7;
       light.radius = 13.0f;
       lightList.push_back(light);
-
-      Transform t{position};
-      t.set_scale(glm::vec3{0.5f});
-
-      lightPositions.push_back(t);
     }
 
     glGenBuffers(1, &lightSSBO);
@@ -132,10 +131,29 @@ int main(int argc, char *argv[])
                  lightList.size() * sizeof(PointLight), lightList.data(),
                  GL_DYNAMIC_DRAW);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, lightSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::LIGHTS,
+                     lightSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
   }
 
+  // camera, light culling and transform updates, one frame ahead of GL
+  FramePipeline pipeline;
+  pipeline.create(
+      [&myModel](FramePacket &packet)
+      {
+        packet.camera.update_matrixes(packet.width, packet.height);
+
+        Timer cullTimer;
+        cullTimer.start();
+        Render::Compute::cull_lights(packet.camera, packet.visibleLights);
+        packet.lightCullMs = cullTimer.stop_and_get_time_ms();
+
+        // only when a node moved
+        packet.drawsChanged = myModel.scene.update();
+        if (packet.drawsChanged)
+          Render::build_scene_draws(myModel, packet.draws);
+      });
+
   while (!glfwWindowShouldClose(window))
   {
     Core::begin_drawing();
@@ -143,55 +161,44 @@ int main(int argc, char *argv[])
     // input
     process_input();
 
-    // update camera matrixes
+    // prep from this input starts on the pipeline thread, the frame drawn
+    // below is the one prepared last iteration
     auto [width, height] = Core::get_framebuffer_size();
+    const FramePacket &packet = pipeline.advance(camera, width, height);
 
-
-    camera.update_matrixes(width, height);
-    glm::mat4 view = camera.view;
-    glm::mat4 projection = camera.projection;
+    // the size the packet's projection was built for, so the screen size
+    // matches it on resize frames too
+    Render::update_frame_uniforms(packet.camera, packet.width, packet.height);
+    if (packet.drawsChanged)
+      Render::upload_scene_draws(packet.draws);
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
     // compute
 
-    Render::Compute::cull_lights_compute(camera);
+    Render::Compute::cull_lights_compute(packet.visibleLights);
+    DebugGui::labeledFloatManager.setValue("Frustum Cull Lights ms: ",
+                                           packet.lightCullMs);
+    DebugGui::labeledFloatManager.setValue("Cull result: ",
+                                           packet.visibleLights.size());
+    DebugGui::labeledFloatManager.setValue("Frame prep ms: ", packet.prepMs);
+    DebugGui::labeledFloatManager.setValue("Prep wait ms: ",
+                                           pipeline.get_wait_ms());
 
     Render::pre_render_checks();
-    Shader gBufferGeoPassShader = //
-        Render::begin_gbuffer_render();
-
-    // render
-    gBufferGeoPassShader.set_mat4("view", view);
-    gBufferGeoPassShader.set_mat4("projection", projection);
-
-    // draw scene
-    for (Mesh &myMesh : myModel.meshes)
-    {
-      glActiveTexture(GL_TEXTURE0);
-
-      glBindTexture(GL_TEXTURE_2D, myMesh.diffuseTextureID);
-      gBufferGeoPassShader.set_mat4("model",
-                                    myMesh.transform.get_matrix());
+    Render::begin_gbuffer_render();
 
-      // glActiveTexture(GL_TEXTURE1);
-      // glBindTexture(GL_TEXTURE_2D, myMesh.specularTextureID);
-      // shader.set_int("material.specular", 1);
-
-      glBindVertexArray(myMesh.vao);
-      glDrawElements(GL_TRIANGLES, myMesh.indicesCount, GL_UNSIGNED_INT, 0);
-    }
+    // draw scene. view and projection come from the frame uniform block,
+    // transforms from the per draw storage buffer
+    Render::draw_scene();
     Render::end_gbuffer_render();
 
-    Render::ssao_pass(projection);
+    Render::ssao_pass();
 
     Shader lightPassShader = //
         Render::begin_lighting_pass();
 
-    lightPassShader.set_float("zNear", camera.near);
-    lightPassShader.set_float("zFar", camera.far);
-    lightPassShader.set_mat4("view", view);
     // glm::vec4 lightPosView = view * glm::vec4(lightPos, 1.0);
     // lightPassShader.set_vec4("light.position", lightPosView);
     // lightPassShader.set_vec4("light.color",
@@ -201,8 +208,11 @@ int main(int argc, char *argv[])
 
     Render::hdr_pass();
 
-    // Render::Debug::show_light_positions(camera);
-    // Render::Compute::draw_aabbs(camera);
+    if (Render::Debug::is_showing_light_gizmos())
+      Render::Debug::show_light_positions(
+          Render::Debug::get_light_gizmo_options());
+    if (Render::Compute::is_showing_cluster_aabbs())
+      Render::Compute::draw_aabbs(Render::Compute::get_cluster_aabb_options());
 
     // quadShader.use();
     // glDisable(GL_DEPTH_TEST);
@@ -217,6 +227,7 @@ int main(int argc, char *argv[])
     Core::end_drawing();
   }
 
+  pipeline.destroy();
   DebugGui::destroy();
 
   Core::close_window();
@@ -1,7 +1,10 @@
 #include "render_manager.h"
 #include "camera.h"
 #include "core/core.h"
+#include "core/geometry_arena.h"
+#include "core/material_library.h"
 #include "core/shader.h"
+#include "core/uniform_buffer.h"
 #include "core/util.h"
 #include "debug/debug_manager.h"
 #include <GLFW/glfw3.h>
@@ -22,7 +25,7 @@
 #include <glm/ext/vector_uint4.hpp>
 #include <glm/geometric.hpp>
 #include <glm/matrix.hpp>
-#include <numeric>
+#include <iostream>
 #include <random>
 #include <string>
 #include <utility>
@@ -30,13 +33,13 @@
 
 // HACK: access light info from main.cpp
 extern std::vector<PointLight> lightList;
-extern std::vector<Transform> lightPositions;
 extern std::vector<glm::mat4> lightMats;
 extern unsigned int lightSSBO;
 
 struct GBufferFramebuffer
 {
-  unsigned int fbo, gPosition, gNormal, gAlbedoSpec, rbo;
+  unsigned int fbo, gPosition, gNormal, gAlbedoSpec;
+  unsigned int depth; // texture, the hi-z pyramid is built from it
   bool dirty = false;
 
   void create(int width, int height)
@@ -82,12 +85,16 @@ struct GBufferFramebuffer
                                    GL_COLOR_ATTACHMENT2};
     glDrawBuffers(3, attachments);
 
-    // renderbuffer
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                              GL_RENDERBUFFER, rbo);
+    // depth stencil. A texture instead of a renderbuffer so culling can read
+    // it, sampling returns depth
+    glGenTextures(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0,
+                 GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, depth, 0);
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     {
@@ -102,10 +109,39 @@ struct GBufferFramebuffer
     glDeleteTextures(1, &gPosition);
     glDeleteTextures(1, &gNormal);
     glDeleteTextures(1, &gAlbedoSpec);
-    glDeleteRenderbuffers(1, &rbo);
+    glDeleteTextures(1, &depth);
   }
 } gBuffer;
 
+// hierarchical depth for occlusion culling, same size as the gbuffer. Level 0
+// is a copy of the gbuffer depth, every next level keeps the farthest depth
+// of the texels below it
+struct HiZPyramid
+{
+  unsigned int texture;
+  int width, height, levels;
+
+  void create(int width, int height)
+  {
+    this->width = width;
+    this->height = height;
+    levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+      ++levels;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  void destroy() { glDeleteTextures(1, &texture); }
+} hiZ;
+
 // simple framebuffer with 1 color attachment
 struct SimpleFrameBuffer
 {
@@ -150,12 +186,21 @@ constexpr unsigned int gridSizeX = 12;
 constexpr unsigned int gridSizeY = 12;
 constexpr unsigned int gridSizeZ = 24;
 constexpr unsigned int numClusters = gridSizeX * gridSizeY * gridSizeZ;
+constexpr unsigned int maxLightsPerCluster = 100;
+// work group size of the light cull shader, one invocation per cluster
+constexpr unsigned int cullLocalSize = 128;
+static_assert(numClusters % cullLocalSize == 0,
+              "cluster count must be a multiple of the cull work group size");
 void init();
+void finish_init();
+ShaderDefines cluster_defines();
+// lights in lightSSBO, the ones that passed frustum culling this frame
+std::size_t visibleLightCount = 0;
 } // namespace Compute
 namespace Debug
 {
 void init();
-}
+} // namespace Debug
 
 } // namespace Render
 //============
@@ -163,11 +208,47 @@ void init();
 namespace Render
 {
 
+// uniform blocks. Layouts follow std140 and must match the glsl blocks
+struct alignas(16) FrameUniforms
+{
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 inverseView;
+  glm::mat4 inverseProjection;
+  glm::uvec2 screenDimensions; // framebuffer pixel dimensions
+  float zNear;
+  float zFar;
+};
+
+constexpr unsigned int SSAO_KERNEL_SIZE = 64;
+struct alignas(16) SSAOKernelUniforms
+{
+  glm::vec4 samples[SSAO_KERNEL_SIZE]; // xyz used, vec4 for std140 stride
+};
+
+struct alignas(16) SSAOPassUniforms
+{
+  float radius;
+  float bias;
+  float power;
+};
+
+struct alignas(16) HDRPassUniforms
+{
+  float exposure;
+  float gamma;
+};
+
+UniformBuffer<FrameUniforms> frameUBO;
+UniformBuffer<SSAOKernelUniforms> ssaoKernelUBO;
+UniformBuffer<SSAOPassUniforms> ssaoPassUBO;
+UniformBuffer<HDRPassUniforms> hdrPassUBO;
+
 // ssao
 SimpleFrameBuffer ssao, ssaoBlur;
 unsigned int noiseTexture; // noise texture for tiling over the screen
-std::vector<glm::vec3> ssaoKernel;
-Shader ssaoShader, ssaoBlurShader;
+ShaderPermutations ssaoShaders; // one variant per kernel size
+Shader ssaoBlurShader;
 
 // NOTE: initial values set by args parser
 glm::vec2 ssaoResolution(-1, -1);
@@ -175,81 +256,121 @@ glm::vec2 ssaoResolution(-1, -1);
 // gbuffer
 glm::vec2 gBufferResolution(-1, -1);
 Shader geoPassShader;
-Shader lightPassShader;
+ShaderPermutations cullDrawsShaders; // per culling phase
+UniformHandle<float> cullDrawsLodPixelError[3]; // see cull_variant
+ShaderPermutations hiZShaders;       // level 0 copy and reduction
+ShaderPermutations lightPassShaders; // with and without ssao
 
 // hdr. We render lighting into hdr fbo
 SimpleFrameBuffer hdr;
 Shader hdrShader;
 
+// every startup program goes through one batch so they compile in parallel
+ShaderBatch shaderBatch;
+
+// variant selection from the current settings
+ShaderFeatures light_pass_features(bool enableSSAO)
+{
+  return {{"ENABLE_SSAO", enableSSAO ? "1" : "0"}};
+}
+ShaderFeatures ssao_features(int kernelSize)
+{
+  return {{"SSAO_KERNEL_SIZE", std::to_string(kernelSize)}};
+}
+ShaderFeatures cull_features(bool latePhase, bool occlusionCulling)
+{
+  // the early phase never tests occlusion
+  return {{"LATE_PHASE", latePhase ? "1" : "0"},
+          {"OCCLUSION_CULLING", latePhase && occlusionCulling ? "1" : "0"}};
+}
+// slot of a cull_features variant in per variant arrays
+int cull_variant(bool latePhase, bool occlusionCulling)
+{
+  return latePhase ? 1 + occlusionCulling : 0;
+}
+
 void init()
 {
 
   // init fbos
   auto [width, height] = Core::get_framebuffer_size();
   gBuffer.create(gBufferResolution.x, gBufferResolution.y);
+  hiZ.create(gBufferResolution.x, gBufferResolution.y);
   hdr.create(width, height, GL_RGBA16F, GL_RGBA); // hdr alwways tied to fbo
                                                   // size
 
   ssao.create(ssaoResolution.x, ssaoResolution.y, GL_RED, GL_RED);
   ssaoBlur.create(ssaoResolution.x, ssaoResolution.y, GL_RED, GL_RED);
 
-  // load shaders
+  // queue shaders. They are compiled in the background until finish_init
   {
     // shader to fill gBuffer with data
-    geoPassShader = Shader(ASSETS_PATH "shaders/gBuffer_geo_pass.vert",
-                           ASSETS_PATH "shaders/gBuffer_geo_pass.frag");
-
-    // light pass is basically a screenspace effect
-    lightPassShader = Shader(ASSETS_PATH "shaders/base/simple_screenspace.vert",
-                             ASSETS_PATH "shaders/gBuffer_light_pass.frag");
-
-    ssaoShader = Shader(ASSETS_PATH "shaders/base/simple_screenspace.vert",
-                        ASSETS_PATH "shaders/ssao.frag");
-    ssaoBlurShader = Shader(ASSETS_PATH "shaders/base/simple_screenspace.vert",
-                            ASSETS_PATH "shaders/ssao_blur.frag");
-    hdrShader = Shader(ASSETS_PATH "shaders/base/simple_screenspace.vert",
-                       ASSETS_PATH "shaders/hdr.frag");
-
-    lightPassShader.use();
-    lightPassShader.set_int("gPosition", 0);
-    lightPassShader.set_int("gNormal", 1);
-    lightPassShader.set_int("gAlbedoSpec", 2);
-    lightPassShader.set_int("ssao", 3);
-
-    ssaoShader.use();
-    ssaoShader.set_int("gPosition", 0);
-    ssaoShader.set_int("gNormal", 1);
-    ssaoShader.set_int("texNoise", 2);
-
-    ssaoBlurShader.use();
-    ssaoBlurShader.set_int("ssaoInput", 0);
-
-    hdrShader.use();
-    hdrShader.set_int("hdrBuffer", 0);
+    // gpu culling of the scene draws
+    cullDrawsShaders.create(ASSETS_PATH "shaders/cull_draws.comp");
+    cullDrawsShaders.prepare(shaderBatch, cull_features(false, false));
+    cullDrawsShaders.prepare(shaderBatch, cull_features(true, false));
+    cullDrawsShaders.prepare(shaderBatch, cull_features(true, true));
+    hiZShaders.create(ASSETS_PATH "shaders/hiz_reduce.comp");
+    hiZShaders.prepare(shaderBatch, {{"HIZ_FROM_DEPTH", "1"}});
+    hiZShaders.prepare(shaderBatch, {{"HIZ_FROM_DEPTH", "0"}});
+
+    static_assert(MaterialLibrary::MAX_ARRAYS == 16,
+                  "gBuffer_geo_pass.frag selects between 16 arrays");
+    shaderBatch.add(geoPassShader, ASSETS_PATH "shaders/gBuffer_geo_pass.vert",
+                    ASSETS_PATH "shaders/gBuffer_geo_pass.frag",
+                    {{"QUANTIZED_VERTICES", QUANTIZED_VERTICES ? "1" : "0"}});
+
+    // light pass is basically a screenspace effect. Both ssao variants are
+    // built up front so toggling ssao never stalls
+    lightPassShaders.create(ASSETS_PATH "shaders/base/simple_screenspace.vert",
+                            ASSETS_PATH "shaders/gBuffer_light_pass.frag",
+                            Compute::cluster_defines());
+    lightPassShaders.prepare(shaderBatch, light_pass_features(true));
+    lightPassShaders.prepare(shaderBatch, light_pass_features(false));
+
+    // other kernel sizes compile on first use
+    ssaoShaders.create(ASSETS_PATH "shaders/base/simple_screenspace.vert",
+                       ASSETS_PATH "shaders/ssao.frag");
+    ssaoShaders.prepare(shaderBatch, ssao_features(ssaoUniforms.samples));
+    shaderBatch.add(ssaoBlurShader,
+                    ASSETS_PATH "shaders/base/simple_screenspace.vert",
+                    ASSETS_PATH "shaders/ssao_blur.frag");
+    shaderBatch.add(hdrShader,
+                    ASSETS_PATH "shaders/base/simple_screenspace.vert",
+                    ASSETS_PATH "shaders/hdr.frag");
+  }
+
+  // init uniform buffers
+  {
+    frameUBO.create(UniformBinding::FRAME);
+    ssaoPassUBO.create(UniformBinding::SSAO_PASS);
+    hdrPassUBO.create(UniformBinding::HDR_PASS);
   }
 
   // init ssao
   {
-    // generate sample kernel
+    // generate sample kernel. The kernel never changes, so it is uploaded
+    // once into its own uniform block
     std::uniform_real_distribution<GLfloat> randomFloats(
         0.0, 1.0); // generates random floats between 0.0 and 1.0
-    ssaoKernel.reserve(64);
+    SSAOKernelUniforms kernel{};
     std::default_random_engine generator;
-    for (unsigned int i = 0; i < 64; ++i)
+    for (unsigned int i = 0; i < SSAO_KERNEL_SIZE; ++i)
     {
       glm::vec3 sample(randomFloats(generator) * 2.0 - 1.0,
                        randomFloats(generator) * 2.0 - 1.0,
                        randomFloats(generator));
       sample = glm::normalize(sample);
       sample *= randomFloats(generator);
-      float scale = float(i) / 64.0f;
+      float scale = float(i) / float(SSAO_KERNEL_SIZE);
 
       // scale samples s.t. they're more aligned to center of kernel
       auto lerp = [](float a, float b, float f) { return a + f * (b - a); };
       scale = lerp(0.1f, 1.0f, scale * scale);
       sample *= scale;
-      ssaoKernel.push_back(sample);
+      kernel.samples[i] = glm::vec4(sample, 0.0f);
     }
+    ssaoKernelUBO.create(UniformBinding::SSAO_KERNEL, &kernel);
 
     // generate noise texture
     // ----------------------
@@ -273,6 +394,28 @@ void init()
 
   Compute::init();
   Debug::init();
+
+  shaderBatch.submit();
+}
+
+void finish_init()
+{
+  shaderBatch.finish();
+
+  for (bool latePhase : {false, true})
+    for (bool occlusionCulling : {false, true})
+      cullDrawsLodPixelError[cull_variant(latePhase, occlusionCulling)] =
+          cullDrawsShaders.get(cull_features(latePhase, occlusionCulling))
+              .get_uniform<float>("lodPixelError");
+
+  // light pass and ssao variants bind their samplers with layout(binding)
+  ssaoBlurShader.use();
+  ssaoBlurShader.set_int("ssaoInput", 0);
+
+  hdrShader.use();
+  hdrShader.set_int("hdrBuffer", 0);
+
+  Compute::finish_init();
 }
 
 // usually we reize, but on intialzation, we don't
@@ -299,6 +442,16 @@ bool &is_wireframe()
   static bool wireframe = false;
   return wireframe;
 }
+bool &is_occlusion_culling()
+{
+  static bool occlusionCulling = true;
+  return occlusionCulling;
+}
+float &get_lod_pixel_error()
+{
+  static float pixelError = 1.0f;
+  return pixelError;
+}
 float &get_hdr_exposure()
 {
   static float exposure = 1.0f;
@@ -310,6 +463,20 @@ float &get_gamma()
   return gamma;
 }
 
+void update_frame_uniforms(const Camera &camera, int width, int height)
+{
+  FrameUniforms frame{};
+  frame.view = camera.view;
+  frame.projection = camera.projection;
+  frame.inverseView = glm::inverse(camera.view);
+  frame.inverseProjection = glm::inverse(camera.projection);
+  frame.screenDimensions = {width, height};
+  frame.zNear = camera.near;
+  frame.zFar = camera.far;
+
+  frameUBO.update(frame);
+}
+
 void pre_render_checks()
 {
   if (Core::iswindow_resized())
@@ -325,6 +492,8 @@ void pre_render_checks()
     gBuffer.dirty = false;
     gBuffer.destroy();
     gBuffer.create(gBufferResolution.x, gBufferResolution.y);
+    hiZ.destroy();
+    hiZ.create(gBufferResolution.x, gBufferResolution.y);
   }
   if (ssao.dirty)
   {
@@ -354,6 +523,193 @@ Shader begin_gbuffer_render()
   geoPassShader.use();
   return geoPassShader;
 }
+// commands are culled into one buffer per phase, see draw_scene
+unsigned int drawCommandBuffers[2] = {};
+unsigned int drawDataSSBO = 0;
+unsigned int drawVisibilityBuffer = 0; // 1 per draw visible last frame
+unsigned int drawCount = 0;
+
+void build_scene_draws(const Model &model, SceneDraws &sceneDraws)
+{
+  // materials come from the material library by index, so every mesh goes
+  // into one multi draw in load order
+  std::vector<DrawElementsIndirectCommand> &commands = sceneDraws.commands;
+  std::vector<DrawData> &draws = sceneDraws.draws;
+  commands.clear();
+  draws.clear();
+  commands.reserve(model.meshes.size());
+  draws.reserve(model.meshes.size());
+
+  for (const Mesh &mesh : model.meshes)
+  {
+    const unsigned int drawIndex = commands.size();
+    commands.push_back({mesh.indicesCount, 1, mesh.firstIndex,
+                        mesh.baseVertex, drawIndex});
+
+    const glm::mat4 &matrix = model.scene.get_world_matrix(mesh.node);
+    DrawData draw{};
+    // quantized positions are mapped back to local space by the same matrix
+    draw.model = matrix * mesh.dequantize;
+    draw.normalMatrix =
+        glm::mat4(glm::transpose(glm::inverse(glm::mat3(matrix))));
+
+    // world bounds of the transformed local box: center moves with the
+    // matrix, extents through the absolute rotation/scale part
+    glm::vec3 center = (mesh.aabbMin + mesh.aabbMax) * 0.5f;
+    glm::vec3 extents = (mesh.aabbMax - mesh.aabbMin) * 0.5f;
+    glm::vec3 worldCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtents{};
+    for (int column = 0; column < 3; ++column)
+      worldExtents += glm::abs(glm::vec3(matrix[column])) * extents[column];
+    draw.aabbMin = glm::vec4(worldCenter - worldExtents, 1.0f);
+    draw.aabbMax = glm::vec4(worldCenter + worldExtents, 1.0f);
+
+    // errors are local, scale them by the largest axis scale
+    float scale = std::max({glm::length(glm::vec3(matrix[0])),
+                            glm::length(glm::vec3(matrix[1])),
+                            glm::length(glm::vec3(matrix[2]))});
+    for (int lod = 0; lod < mesh.lodCount; ++lod)
+    {
+      draw.lodFirstIndex[lod] = mesh.lods[lod].firstIndex;
+      draw.lodIndexCount[lod] = mesh.lods[lod].indicesCount;
+      draw.lodError[lod] = mesh.lods[lod].error * scale;
+    }
+    draw.lodCount = mesh.lodCount;
+    draw.material = mesh.material;
+    draws.push_back(draw);
+  }
+}
+
+void upload_scene_draws(const SceneDraws &sceneDraws)
+{
+  const std::vector<DrawElementsIndirectCommand> &commands =
+      sceneDraws.commands;
+  const std::vector<DrawData> &draws = sceneDraws.draws;
+  drawCount = commands.size();
+
+  if (!drawDataSSBO)
+  {
+    glGenBuffers(2, drawCommandBuffers);
+    glGenBuffers(1, &drawDataSSBO);
+    glGenBuffers(1, &drawVisibilityBuffer);
+  }
+  // culling rewrites instanceCount and the lod range, the rest stays as
+  // uploaded here
+  for (unsigned int buffer : drawCommandBuffers)
+  {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 commands.size() * sizeof(DrawElementsIndirectCommand),
+                 commands.data(), GL_DYNAMIC_DRAW);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // start with everything visible, so the first frame's early phase already
+  // lays down a useful depth buffer
+  std::vector<unsigned int> visibility(commands.size(), 1u);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawVisibilityBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               visibility.size() * sizeof(unsigned int), visibility.data(),
+               GL_DYNAMIC_COPY);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataSSBO);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(DrawData),
+               draws.data(), GL_STATIC_DRAW);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::DRAWS,
+                   drawDataSSBO);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  Core::GL::get_geometry_arena().reserve_draw_ids(commands.size());
+
+  std::cout << "Scene draws: " << commands.size() << " draws, "
+            << Core::GL::get_material_library().get_material_count()
+            << " materials\n";
+}
+
+void upload_scene_draws(const Model &model)
+{
+  SceneDraws sceneDraws;
+  build_scene_draws(model, sceneDraws);
+  upload_scene_draws(sceneDraws);
+}
+
+// write the visible draws of a phase into its command buffer
+void cull_draws(bool latePhase, bool occlusionCulling)
+{
+  const Shader &shader =
+      cullDrawsShaders.get(cull_features(latePhase, occlusionCulling));
+  shader.use();
+  shader.set(cullDrawsLodPixelError[cull_variant(latePhase, occlusionCulling)],
+             get_lod_pixel_error());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::DRAW_COMMANDS,
+                   drawCommandBuffers[latePhase]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::DRAW_VISIBILITY,
+                   drawVisibilityBuffer);
+  if (latePhase && occlusionCulling)
+  {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hiZ.texture);
+  }
+
+  glDispatchCompute((drawCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// rebuild the hi-z pyramid from the current gbuffer depth
+void build_hiz()
+{
+  auto dispatch = [](int width, int height)
+  { glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1); };
+
+  hiZShaders.get({{"HIZ_FROM_DEPTH", "1"}}).use();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+  glBindImageTexture(1, hiZ.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  dispatch(hiZ.width, hiZ.height);
+
+  hiZShaders.get({{"HIZ_FROM_DEPTH", "0"}}).use();
+  for (int level = 1; level < hiZ.levels; ++level)
+  {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(0, hiZ.texture, level - 1, GL_FALSE, 0, GL_READ_ONLY,
+                       GL_R32F);
+    glBindImageTexture(1, hiZ.texture, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    dispatch(std::max(1, hiZ.width >> level), std::max(1, hiZ.height >> level));
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void submit_draws(unsigned int commandBuffer)
+{
+  geoPassShader.use();
+  glBindVertexArray(Core::GL::get_geometry_arena().get_vao());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  Core::GL::get_material_library().bind();
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                              drawCount, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// two phase culling. The early phase draws what was visible last frame and
+// passes the frustum, its depth feeds the hi-z pyramid. The late phase tests
+// everything against frustum and pyramid, draws what became visible and
+// records visibility for the next frame
+void draw_scene()
+{
+  if (drawCount == 0)
+    return;
+
+  bool occlusionCulling = is_occlusion_culling();
+  cull_draws(false, occlusionCulling);
+  submit_draws(drawCommandBuffers[0]);
+
+  if (occlusionCulling)
+    build_hiz();
+  cull_draws(true, occlusionCulling);
+  submit_draws(drawCommandBuffers[1]);
+}
+
 void end_gbuffer_render()
 {
   // reset glViewport to default
@@ -363,7 +719,7 @@ void end_gbuffer_render()
   glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // reset wireframe
   // glBindFramebuffer(GL_FRAMEBUFFER, 0);      // bind to default fbo
 }
-void ssao_pass(glm::mat4 projection)
+void ssao_pass()
 {
   if (!ssaoUniforms.enableSSAO)
   {
@@ -374,17 +730,14 @@ void ssao_pass(glm::mat4 projection)
   glViewport(0, 0, ssaoResolution.x, ssaoResolution.y);
   glBindFramebuffer(GL_FRAMEBUFFER, ssao.fbo);
   glClear(GL_COLOR_BUFFER_BIT);
-  ssaoShader.use();
-  // Send kernel + rotation
-  for (unsigned int i = 0; i < 64; ++i)
-    ssaoShader.set_vec3(("samples[" + std::to_string(i) + "]").c_str(),
-                        ssaoKernel[i]);
-  ssaoShader.set_mat4("projection", projection);
-  ssaoShader.set_int("kernelSize", ssaoUniforms.samples);
-  ssaoShader.set_float("radius", ssaoUniforms.radius);
-  ssaoShader.set_float("bias", ssaoUniforms.bias);
-  ssaoShader.set_float("power", ssaoUniforms.power);
-  ssaoShader.set_uvec2("screenDimensions", {width, height});
+  ssaoShaders.get(ssao_features(ssaoUniforms.samples)).use();
+  // kernel and projection already live in their uniform blocks, kernel size
+  // is baked into the variant
+  SSAOPassUniforms pass{};
+  pass.radius = ssaoUniforms.radius;
+  pass.bias = ssaoUniforms.bias;
+  pass.power = ssaoUniforms.power;
+  ssaoPassUBO.update(pass);
 
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, gBuffer.gPosition);
@@ -415,6 +768,8 @@ Shader begin_lighting_pass()
   glBindFramebuffer(GL_FRAMEBUFFER, hdr.fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  const Shader &lightPassShader =
+      lightPassShaders.get(light_pass_features(ssaoUniforms.enableSSAO));
   lightPassShader.use();
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, gBuffer.gPosition);
@@ -425,12 +780,6 @@ Shader begin_lighting_pass()
   glActiveTexture(GL_TEXTURE3);
   glBindTexture(GL_TEXTURE_2D, ssaoBlur.color); // read ssao from blur fbo
 
-  using namespace Compute;
-  auto [width, height] = Core::get_framebuffer_size();
-  lightPassShader.set_bool("enableSSAO", ssaoUniforms.enableSSAO);
-  lightPassShader.set_uvec3("gridSize", {gridSizeX, gridSizeY, gridSizeZ});
-  lightPassShader.set_uvec2("screenDimensions", {width, height});
-
   return lightPassShader; // return shader for further uniform setting
 }
 void end_lighting_pass()
@@ -446,8 +795,10 @@ void hdr_pass()
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, hdr.color);
 
-  hdrShader.set_float("exposure", get_hdr_exposure());
-  hdrShader.set_float("gamma", get_gamma());
+  HDRPassUniforms pass{};
+  pass.exposure = get_hdr_exposure();
+  pass.gamma = get_gamma();
+  hdrPassUBO.update(pass);
 
   Core::GL::render_fullscreen_quad();
 }
@@ -456,19 +807,42 @@ namespace Debug
 
 // constantShader outputs constant color
 
-Shader constantInstanced;
 Shader constantShader;
+ShaderPermutations lightGizmoShaders;
+
+ShaderFeatures light_gizmo_features(const LightGizmoOptions &options)
+{
+  return {{"SHOW_RADIUS", options.showRadius ? "1" : "0"},
+          {"COLOR_BY_CLUSTER_COUNT", options.colorByClusterCount ? "1" : "0"}};
+}
 
 void init()
 {
   // load shaders
-  constantInstanced = Shader(ASSETS_PATH "shaders/constant_instanced.vert",
-                             ASSETS_PATH "shaders/constant.frag");
-  constantShader = Shader(ASSETS_PATH "shaders/constant.vert",
-                          ASSETS_PATH "shaders/constant.frag");
+  lightGizmoShaders.create(ASSETS_PATH "shaders/light_gizmo.vert",
+                           ASSETS_PATH "shaders/debug_color.frag",
+                           Compute::cluster_defines());
+  // every variant the debug window can toggle to
+  for (bool showRadius : {false, true})
+    for (bool colorByClusterCount : {false, true})
+      lightGizmoShaders.prepare(
+          shaderBatch, light_gizmo_features({showRadius, colorByClusterCount}));
+  shaderBatch.add(constantShader, ASSETS_PATH "shaders/constant.vert",
+                  ASSETS_PATH "shaders/constant.frag");
 }
 
-void show_light_positions(const Camera &camera)
+bool &is_showing_light_gizmos()
+{
+  static bool showing = false;
+  return showing;
+}
+LightGizmoOptions &get_light_gizmo_options()
+{
+  static LightGizmoOptions options;
+  return options;
+}
+
+void show_light_positions(const LightGizmoOptions &options)
 {
   // copy depth values from gBuffer to default
   auto [dstWidth, dstHeight] = Core::get_framebuffer_size();
@@ -478,15 +852,14 @@ void show_light_positions(const Camera &camera)
                     dstWidth, dstHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-  constantInstanced.use();
-  constantInstanced.set_mat4("projection", camera.projection);
-  constantInstanced.set_mat4("view", camera.view);
-  constantInstanced.set_vec4("color", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-
-
-
-  Core::GL::draw_cube(lightPositions);
-
+  // everything per light comes from the light and cluster buffers, so there
+  // is nothing to upload. View and projection come from the frame uniform
+  // block
+  lightGizmoShaders.get(light_gizmo_features(options)).use();
+  if (options.showRadius)
+    Core::GL::draw_sphere_instanced(Compute::visibleLightCount);
+  else
+    Core::GL::draw_cube_instanced(Compute::visibleLightCount);
 }
 
 } // namespace Debug
@@ -512,8 +885,9 @@ struct alignas(16) Cluster
   glm::vec4 maxPoint;
   unsigned int count;
   unsigned int
-      lightIndices[100]; // the lights visible to this cluster. Elements
-                         // are indices that access the global light ssbo
+      lightIndices[maxLightsPerCluster]; // the lights visible to this
+                                         // cluster. Elements are indices
+                                         // that access the global light ssbo
 };
 
 
@@ -533,7 +907,8 @@ void init_ssbos()
     // overridden
     glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Cluster) * numClusters,
                  nullptr, GL_STATIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusterGridSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, StorageBinding::CLUSTERS,
+                     clusterGridSSBO);
   }
 }
 
@@ -626,78 +1001,128 @@ bool isLightInFrustum(const PointLight &light,
   return true;
 }
 
-void update_ssbos(const Camera &camera)
+void cull_lights(const Camera &camera, std::vector<PointLight> &visibleLights)
 {
-  // cull lights
-  static Timer timer;
-  timer.start();
-
   glm::mat4 viewProj = camera.projection * camera.view;
   std::array<Plane, 6> planes = extractFrustumPlanes(viewProj);
 
-  std::vector<PointLight> visibleLights;
+  visibleLights.clear();
   for (int k = 0; k < lightList.size(); ++k)
   {
-    PointLight &light = lightList.at(k);
-    Transform &t = lightPositions.at(
-        k); // serves as center that doesn't change :D, very messy
-    const int radius = 10;
-    const float speed = 20;
-    // light.position.x =
-    //     t.position.x + radius * cos(glm::radians(glfwGetTime() * speed));
-    // light.position.z =
-    //     t.position.z + radius * sin(glm::radians(glfwGetTime() * speed));
-
+    const PointLight &light = lightList.at(k);
     if (isLightInFrustum(light, planes))
     {
       visibleLights.push_back(light);
     }
   }
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
-  glBufferData(GL_SHADER_STORAGE_BUFFER,
-               visibleLights.size() * sizeof(PointLight), visibleLights.data(),
-               GL_DYNAMIC_DRAW);
-
-  DebugGui::labeledFloatManager.setValue("Frustum Cull Lights ms: ",
-                                         timer.stop_and_get_time_ms());
-  DebugGui::labeledFloatManager.setValue("Cull result: ", visibleLights.size());
 }
 
 Shader clusterComp;
 Shader cullLightComp;
 
-void cull_lights_compute(const Camera &camera)
-{
-  update_ssbos(camera);
+// debug view of the cluster grid
+Shader clusterAABBShader;
+UniformHandle<unsigned int> clusterAABBFirstCluster;
+UniformHandle<bool> clusterAABBNonEmptyOnly;
+unsigned int emptyVAO = 0;
 
-  auto [width, height] = Core::get_framebuffer_size();
+void cull_lights_compute(const std::vector<PointLight> &visibleLights)
+{
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               visibleLights.size() * sizeof(PointLight), visibleLights.data(),
+               GL_DYNAMIC_DRAW);
+  visibleLightCount = visibleLights.size();
 
-  // build AABBs, doesn't need to run every frame but fast
+  // build AABBs, doesn't need to run every frame but fast. Camera data and
+  // grid size come from the frame uniform block and cluster defines
   clusterComp.use();
-  clusterComp.set_float("zNear", camera.near);
-  clusterComp.set_float("zFar", camera.far);
-  clusterComp.set_mat4("inverseProjection", glm::inverse(camera.projection));
-  clusterComp.set_uvec3("gridSize", {gridSizeX, gridSizeY, gridSizeZ});
-  clusterComp.set_uvec2("screenDimensions", {width, height});
 
   glDispatchCompute(gridSizeX, gridSizeY, gridSizeZ);
   glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
   // cull lights
   cullLightComp.use();
-  cullLightComp.set_mat4("viewMatrix", camera.view);
 
-  glDispatchCompute(27, 1, 1);
+  glDispatchCompute(numClusters / cullLocalSize, 1, 1);
   glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
+// compile time constants shared between c++ and the cluster shaders, see
+// shaders/include/clusters.glsl
+ShaderDefines cluster_defines()
+{
+  return {
+      {"GRID_SIZE_X", std::to_string(gridSizeX) + "u"},
+      {"GRID_SIZE_Y", std::to_string(gridSizeY) + "u"},
+      {"GRID_SIZE_Z", std::to_string(gridSizeZ) + "u"},
+      {"MAX_LIGHTS_PER_CLUSTER", std::to_string(maxLightsPerCluster) + "u"},
+      {"LOCAL_SIZE", std::to_string(cullLocalSize)},
+  };
+}
+
 void init()
 {
   init_ssbos();
   // load shaders
-  clusterComp = Shader(ASSETS_PATH "shaders/clusterShader.comp");
-  cullLightComp = Shader(ASSETS_PATH "shaders/clusterCullLightShader.comp");
+  shaderBatch.add(clusterComp, ASSETS_PATH "shaders/clusterShader.comp",
+                  cluster_defines());
+  shaderBatch.add(cullLightComp,
+                  ASSETS_PATH "shaders/clusterCullLightShader.comp",
+                  cluster_defines());
+  shaderBatch.add(clusterAABBShader, ASSETS_PATH "shaders/cluster_aabb.vert",
+                  ASSETS_PATH "shaders/debug_color.frag", cluster_defines());
+  // attributeless draws still need a vao bound
+  glGenVertexArrays(1, &emptyVAO);
+}
+
+void finish_init()
+{
+  clusterAABBFirstCluster =
+      clusterAABBShader.get_uniform<unsigned int>("firstCluster");
+  clusterAABBNonEmptyOnly =
+      clusterAABBShader.get_uniform<bool>("nonEmptyOnly");
+}
+
+bool &is_showing_cluster_aabbs()
+{
+  static bool showing = false;
+  return showing;
+}
+ClusterAABBOptions &get_cluster_aabb_options()
+{
+  static ClusterAABBOptions options;
+  return options;
+}
+unsigned int get_cluster_slice_count() { return gridSizeZ; }
+
+void draw_aabbs(const ClusterAABBOptions &options)
+{
+  const unsigned int lastSlice = std::min(options.lastSlice, gridSizeZ - 1);
+  if (options.firstSlice > lastSlice)
+    return;
 
+  // clusters are stored slice by slice, so a slice range is one contiguous
+  // run of instances. Corners and counts are pulled from clusterSSBO on the
+  // gpu, view and projection come from the frame uniform block. Nothing is
+  // read back, so this can stay on while profiling the culling passes
+  constexpr unsigned int sliceClusters = gridSizeX * gridSizeY;
+  const unsigned int firstCluster = options.firstSlice * sliceClusters;
+  const unsigned int clusterCount =
+      (lastSlice - options.firstSlice + 1) * sliceClusters;
+
+  clusterAABBShader.use();
+  clusterAABBShader.set(clusterAABBFirstCluster, firstCluster);
+  clusterAABBShader.set(clusterAABBNonEmptyOnly, options.nonEmptyOnly);
+
+  // an overlay, the boxes span the whole frustum
+  const bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+  glDisable(GL_DEPTH_TEST);
+  glBindVertexArray(emptyVAO);
+  glDrawArraysInstanced(GL_LINES, 0, 24, clusterCount);
+  glBindVertexArray(0);
+  if (depthTest)
+    glEnable(GL_DEPTH_TEST);
 }
 
 } // namespace Compute
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "camera.h"
+#include "core/core.h"
 #include "core/shader.h"
 #include <array>
 #include <cstdint>
@@ -8,6 +9,7 @@
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/ext/vector_float2.hpp>
 #include <glm/ext/vector_float4.hpp>
+#include <glm/ext/vector_uint4.hpp>
 #include <stdexcept>
 #include <vector>
 
@@ -21,13 +23,65 @@ struct alignas(16) PointLight
 
 namespace Render
 {
+// creates render targets and starts compiling shaders in the background
 void init();
+// waits for the shaders started by init(). Do other startup work, like model
+// loading, between the two so it overlaps with shader compilation
+void finish_init();
 void pre_render_checks();
 
+// upload camera and screen data shared by every pass. Call once per frame
+// after the camera matrixes are updated, with the framebuffer size they were
+// built for
+void update_frame_uniforms(const Camera &camera, int width, int height);
+
+// layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+  unsigned int count;
+  unsigned int instanceCount;
+  unsigned int firstIndex;
+  int baseVertex;
+  unsigned int baseInstance; // the draw index, see GeometryArena
+};
+
+// per draw data, indexed by draw id in gBuffer_geo_pass.vert
+struct alignas(16) DrawData
+{
+  glm::mat4 model;
+  glm::mat4 normalMatrix; // inverse transpose of model, mat4 for std430
+  glm::vec4 aabbMin;      // world space bounds for culling
+  glm::vec4 aabbMax;
+  // lod chain of the mesh, culling picks one per frame
+  glm::uvec4 lodFirstIndex;
+  glm::uvec4 lodIndexCount;
+  glm::vec4 lodError; // world space
+  unsigned int lodCount;
+  unsigned int material; // MaterialLibrary index
+};
+static_assert(Mesh::MAX_LODS == 4, "DrawData stores lods in 4 wide vectors");
+
+struct SceneDraws
+{
+  std::vector<DrawElementsIndirectCommand> commands;
+  std::vector<DrawData> draws;
+};
+
+// the indirect draw commands and per draw data of a model, from its current
+// world matrices. Cpu only, safe off the GL thread
+void build_scene_draws(const Model &model, SceneDraws &sceneDraws);
+void upload_scene_draws(const SceneDraws &sceneDraws);
+// build and upload. Call after loading and whenever its meshes or transforms
+// change
+void upload_scene_draws(const Model &model);
+
 Shader begin_gbuffer_render();
+// the uploaded scene with multi draw indirect, one call per culling phase.
+// Textures and materials are bound once from the material library
+void draw_scene();
 void end_gbuffer_render();
 
-void ssao_pass(glm::mat4 projection);
+void ssao_pass();
 
 Shader begin_lighting_pass();
 void end_lighting_pass();
@@ -35,6 +89,9 @@ void end_lighting_pass();
 void hdr_pass();
 
 bool &is_wireframe();
+bool &is_occlusion_culling();
+// largest on screen error in pixels a mesh lod may introduce
+float &get_lod_pixel_error();
 float &get_hdr_exposure();
 float &get_gamma();
 
@@ -52,12 +109,48 @@ void set_gbuffer_resolution(glm::vec2 vec2, bool resize = true);
 
 namespace Debug
 {
-void show_light_positions(const Camera &camera);
-}
+struct LightGizmoOptions
+{
+  // sphere of the light's radius instead of a small cube at its position
+  bool showRadius = false;
+  // heat color by the light count of the cluster the light sits in, instead
+  // of the light's own color
+  bool colorByClusterCount = false;
+};
+// gizmos for the lights that passed frustum culling, drawn over the scene.
+// The vertex shader pulls each light from the light buffer by instance id,
+// so gizmos follow the lights the gpu actually uses and cost no uploads
+void show_light_positions(const LightGizmoOptions &options = {});
+
+// debug window settings, the frame loop draws the gizmos when enabled
+bool &is_showing_light_gizmos();
+LightGizmoOptions &get_light_gizmo_options();
+} // namespace Debug
 namespace Compute
 {
-void cull_lights_compute(const Camera &camera);
-void draw_aabbs(const Camera &camera);
+// frustum cull the scene's lights on the cpu. No GL, runs on the frame prep
+// thread
+void cull_lights(const Camera &camera, std::vector<PointLight> &visibleLights);
+// upload the lights that passed cull_lights and assign them to clusters
+void cull_lights_compute(const std::vector<PointLight> &visibleLights);
+
+struct ClusterAABBOptions
+{
+  // z slices to draw, inclusive. Clamped to the grid
+  unsigned int firstSlice = 0;
+  unsigned int lastSlice = ~0u;
+  // skip clusters no light was assigned to
+  bool nonEmptyOnly = false;
+};
+// wireframe box per cluster colored by its light count, drawn over the
+// scene. Run after cull_lights_compute. Everything stays on the gpu
+void draw_aabbs(const ClusterAABBOptions &options = {});
+
+// debug window settings, the frame loop draws the boxes when enabled
+bool &is_showing_cluster_aabbs();
+ClusterAABBOptions &get_cluster_aabb_options();
+// z slices of the cluster grid
+unsigned int get_cluster_slice_count();
 } // namespace Compute
 
 } // namespace Render